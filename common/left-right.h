@@ -0,0 +1,99 @@
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <functional>
+#include <mutex>
+#include <thread>
+
+/* Two copies of a value shared by many readers and one writer at a time, with the left-right technique.
+ * Readers always visit the published copy and never wait or retry, they only announce themselves on a striped counter
+ * so that threads on different cores do not share a cache line. The writer changes the other copy, publishes it, waits
+ * until no reader is left on the old copy and then makes the same change on it.
+ * A change is therefore applied twice and the value is held twice, but a reader never sees it half changed and nothing
+ * is freed under its feet.
+ */
+template <typename T> class LeftRight
+{
+  private:
+	static const size_t STRIPES = 16;
+
+	struct alignas(64) Counter
+	{
+		std::atomic<long> count{0};
+	};
+
+  private:
+	T copies[2];
+	std::atomic<int> published{0}; // copy the readers visit
+	std::atomic<int> version{0};   // set of counters new readers announce themselves on
+	mutable Counter readers[2][STRIPES];
+	std::mutex writer;
+
+  private:
+	static size_t Stripe()
+	{
+		static thread_local size_t stripe = std::hash<std::thread::id>{}(std::this_thread::get_id()) % STRIPES;
+		return stripe;
+	}
+
+	bool Idle(int v) const
+	{
+		for (const Counter &counter : readers[v])
+		{
+			if (counter.count.load() != 0)
+			{
+				return false;
+			}
+		}
+		return true;
+	}
+
+	void WaitIdle(int v) const
+	{
+		while (!Idle(v))
+		{
+			std::this_thread::yield();
+		}
+	}
+
+  public:
+	LeftRight() = default;
+	LeftRight(const LeftRight &) = delete;
+	LeftRight &operator=(const LeftRight &) = delete;
+
+	// run visit on the published copy and return its result, visit must only call const members
+	// the copy stays valid and unchanged until visit returns, whatever the writer does meanwhile
+	template <typename Visit> auto Read(Visit visit) const
+	{
+		Counter &counter = readers[version.load()][Stripe()];
+		counter.count.fetch_add(1);
+		struct Leave
+		{
+			Counter &counter;
+			~Leave()
+			{
+				counter.count.fetch_sub(1);
+			}
+		} leave{counter};
+		return visit(copies[published.load()]);
+	}
+
+	// run change on both copies in turn, one at a time, change must do the same on both
+	// the change is visible to every read that starts after Write returns
+	template <typename Change> void Write(Change change)
+	{
+		std::lock_guard<std::mutex> lock(writer);
+		int side = published.load();
+		change(copies[1 - side]);
+		published.store(1 - side);
+
+		// readers that started before the store may still be on the old copy, they are counted in one of the two
+		// sets; move new readers to the other set and wait until both drain
+		int prev = version.load();
+		WaitIdle(1 - prev);
+		version.store(1 - prev);
+		WaitIdle(prev);
+
+		change(copies[side]);
+	}
+};
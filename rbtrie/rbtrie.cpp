@@ -1,12 +1,223 @@
-﻿#include "rbtrieRB.h"
+﻿#include "rbtrieConcurrent.h"
+#include "rbtrieRB.h"
+#include "rbtrieSharded.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
 #include <fstream>
 #include <iostream>
+#include <random>
 #include <sstream>
 #include <string_view>
+#include <thread>
+#include <vector>
 
 #include <windows.h>
 
-int main()
+// compare SearchBatch against a loop of single Search calls on random ascii words
+void SearchBatchBenchmark()
+{
+	const int words = 1000000;
+	const int queries = 4000000;
+	const int batch = 256;
+
+	std::mt19937 gen(2024);
+	auto randomWord = [&gen]() {
+		std::string word(3 + gen() % 10, 'a');
+		for (char &c : word)
+		{
+			c = 'a' + gen() % 26;
+		}
+		return word;
+	};
+
+	RBTrieRB trie;
+	for (int i = 0; i < words; ++i)
+	{
+		trie.Insert(randomWord(), "value");
+	}
+	std::vector<std::string> keys(queries);
+	for (auto &key : keys)
+	{
+		key = randomWord();
+	}
+	std::vector<std::string_view> views(keys.begin(), keys.end());
+
+	auto start = std::chrono::steady_clock::now();
+	size_t hits = 0;
+	for (const auto &key : views)
+	{
+		hits += trie.Search(key) != nullptr;
+	}
+	auto end = std::chrono::steady_clock::now();
+	std::cout << "Search: " << std::chrono::duration_cast<std::chrono::milliseconds>(end - start).count() << " ms, "
+			  << hits << " hits\n";
+
+	start = std::chrono::steady_clock::now();
+	hits = 0;
+	for (size_t i = 0; i < views.size(); i += batch)
+	{
+		std::span<const std::string_view> chunk(views.data() + i, std::min<size_t>(batch, views.size() - i));
+		for (const auto &result : trie.SearchBatch(chunk))
+		{
+			hits += bool(result);
+		}
+	}
+	end = std::chrono::steady_clock::now();
+	std::cout << "SearchBatch: " << std::chrono::duration_cast<std::chrono::milliseconds>(end - start).count()
+			  << " ms, " << hits << " hits\n";
+}
+
+// SearchBatch must agree with Lookup on every key, including invalid ones whose descent stops early
+bool SearchBatchTest()
+{
+	const std::vector<std::string_view> keys = {"",		"abc", "abd", "zz\xff", "a\xff", "\xff",
+												"ab\xc3", "\xc3", "zzz", "abc\xff"};
+	RBTrieRB trie;
+	for (int round = 0; round < 2; ++round)
+	{
+		// the first round runs on an empty trie
+		std::vector<RBTrieRB::SearchResult> results = trie.SearchBatch(keys);
+		for (size_t i = 0; i < keys.size(); ++i)
+		{
+			RBTrieRB::SearchResult expected = trie.Lookup(keys[i]);
+			if (results[i].status != expected.status || results[i].value != expected.value)
+			{
+				return false;
+			}
+		}
+		trie.Insert("abc", "1");
+		trie.Insert("abd", "2");
+		trie.Insert("b", "3");
+	}
+	return true;
+}
+
+// load hand-made snapshots and check that only the ones keeping the balancing and ordering rules are accepted
+bool CorruptLoadTest()
+{
+	using Node = CompactRBTrie::Node;
+	const uint32_t black = CompactRBTrie::BLACK, end = CompactRBTrie::END;
+	const std::vector<std::string_view> values = {"1", "2", "3", "4"};
+	auto load = [&values](const std::vector<Node> &nodes) {
+		RBTrieRB trie;
+		return trie.Load(CompactRBTrie(nodes, values, {}));
+	};
+
+	// b is the black root, a and c are its red lo and hi kids
+	const std::vector<Node> valid = {Node{0, 0, 0, 0, 0}, Node{'b' | black | CompactRBTrie::SUBROOT | end, 1, 2, 0, 3},
+									 Node{'a' | end, 0, 0, 0, 0}, Node{'c' | end, 2, 0, 0, 0}};
+	std::vector<Node> redRoot = valid, unequal = valid, unordered = valid, unmarked = valid;
+	redRoot[1].bits &= ~black;
+	unequal[3].bits |= black;
+	std::swap(unordered[2].bits, unordered[3].bits);
+	unmarked[1].bits &= ~CompactRBTrie::SUBROOT;
+	// c is the black root, a is its red lo kid with the red hi kid b, d is its red hi kid
+	const std::vector<Node> redRed = {Node{0, 0, 0, 0, 0}, Node{'c' | black | end, 2, 2, 0, 4},
+									  Node{'a' | end, 0, 0, 0, 3}, Node{'b' | end, 1, 0, 0, 0},
+									  Node{'d' | end, 3, 0, 0, 0}};
+	if (!load(valid) || load(redRoot) || load(unequal) || load(unordered) || load(redRed))
+	{
+		return false;
+	}
+
+	// the subroot flag is not trusted, removing a key walks up to its subroot and must stop at the root
+	RBTrieRB trie;
+	if (!trie.Load(CompactRBTrie(unmarked, values, {})))
+	{
+		return false;
+	}
+	trie.Remove("b");
+	return trie.Size() == 2 && trie.Search(std::string_view("b")) == nullptr &&
+		   trie.Search(std::string_view("c")) != nullptr;
+}
+
+// two writers insert their own keys while two readers search them, a key found must carry its own value
+bool ConcurrentTest()
+{
+	const int keys = 2000;
+	ConcurrentRBTrie<> trie;
+	std::atomic<bool> wrong = false;
+	std::vector<std::thread> threads;
+	for (int t = 0; t < 2; ++t)
+	{
+		threads.emplace_back([&trie, t]() {
+			for (int i = t; i < keys; i += 2)
+			{
+				trie.Insert("key" + std::to_string(i), std::to_string(i));
+			}
+		});
+		threads.emplace_back([&trie, &wrong]() {
+			for (int i = 0; i < keys; ++i)
+			{
+				std::optional<std::string> value = trie.Search("key" + std::to_string(i));
+				if (value && *value != std::to_string(i))
+				{
+					wrong = true;
+				}
+			}
+		});
+	}
+	for (auto &thread : threads)
+	{
+		thread.join();
+	}
+	for (int i = 0; i < keys; ++i)
+	{
+		if (trie.Search("key" + std::to_string(i)) != std::to_string(i))
+		{
+			return false;
+		}
+	}
+	return !wrong && trie.Size() == keys;
+}
+
+// fill four shards from as many threads, then walk the words in order across the shard boundaries
+bool ShardedTest()
+{
+	const std::vector<std::string> firsts = {"a", "f", "k", "p", "u", "z"};
+	ShardedRBTrie<> trie(4);
+	std::vector<std::thread> threads;
+	for (const std::string &first : firsts)
+	{
+		threads.emplace_back([&trie, first]() {
+			for (int i = 0; i < 100; ++i)
+			{
+				trie.Insert(first + std::to_string(i), first);
+			}
+		});
+	}
+	for (auto &thread : threads)
+	{
+		thread.join();
+	}
+
+	std::vector<std::string> words;
+	for (const std::string &first : firsts)
+	{
+		for (int i = 0; i < 100; ++i)
+		{
+			words.push_back(first + std::to_string(i));
+		}
+	}
+	std::sort(words.begin(), words.end());
+	if (trie.ShardCount() != 4 || trie.Size() != (long long)words.size())
+	{
+		return false;
+	}
+	for (long long k = 1; k <= (long long)words.size(); ++k)
+	{
+		if (trie.GetKthWord(k) != words[k - 1] || trie.Rank(words[k - 1]) != k ||
+			trie.Search(words[k - 1]) != words[k - 1].substr(0, 1))
+		{
+			return false;
+		}
+	}
+	return trie.Rank("b") == 0 && trie.GetKthWord(words.size() + 1).empty();
+}
+
+// pass "bench" on the command line to run the benchmarks
+int main(int argc, char *argv[])
 {
 	SetConsoleOutputCP(CP_UTF8);
 
@@ -25,5 +236,24 @@ int main()
 		std::cout << str << '\n';
 	}
 
+	RBTrieRB loaded;
+	if (trie.Save("rbtrie.snap") && loaded.Load("rbtrie.snap"))
+	{
+		for (const auto &str : loaded.PrefixSearch((const char *)u8"c"))
+		{
+			std::cout << str << '\n';
+		}
+	}
+
+	std::cout << (SearchBatchTest() ? "SearchBatch agrees with Lookup\n" : "SearchBatch disagrees with Lookup\n");
+	std::cout << (CorruptLoadTest() ? "Corrupt snapshots rejected\n" : "Corrupt snapshot loaded\n");
+	std::cout << (ConcurrentTest() ? "Concurrent trie consistent\n" : "Concurrent trie inconsistent\n");
+	std::cout << (ShardedTest() ? "Sharded trie in order\n" : "Sharded trie out of order\n");
+
+	if (argc > 1 && std::string_view(argv[1]) == "bench")
+	{
+		SearchBatchBenchmark();
+	}
+
 	return 0;
 }
@@ -0,0 +1,305 @@
+#pragma once
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+/* Read-only snapshot of a trie in a compact, relocatable layout.
+ * Nodes sit in one contiguous array and link to each other by 32-bit index, index 0 standing in for nil. A codepoint
+ * only needs 21 bits, so color, subroot and end flags are packed into the bits above it and a node takes 20 bytes.
+ * The snapshot is a single pointer-free buffer (header, nodes in preorder, value offsets, value weights, value bytes),
+ * so it can be written out and either read back or mapped and viewed in place.
+ */
+class CompactRBTrie
+{
+  public:
+	static const uint32_t MAGIC = 0x43545242; // "RBTC"
+	static const uint32_t VERSION = 3;
+	static const uint32_t ENDIAN = 0x01020304; // reads back swapped on a machine of the other byte order
+
+	static const uint32_t CODEPOINT = 0x1FFFFF;
+	static const uint32_t BLACK = 1u << 21;
+	static const uint32_t SUBROOT = 1u << 22; // informative only, loading derives subroots from the links
+	static const uint32_t END = 1u << 23;
+
+	struct Node
+	{
+		uint32_t bits;	// codepoint and flags
+		uint32_t value; // index into the value table, only meaningful when END is set
+		uint32_t lo;
+		uint32_t eq;
+		uint32_t hi;
+
+		char32_t Codepoint() const
+		{
+			return bits & CODEPOINT;
+		}
+		bool End() const
+		{
+			return bits & END;
+		}
+	};
+
+	struct Header
+	{
+		uint32_t magic;
+		uint32_t version;
+		uint32_t endian;
+		uint32_t nodeCount; // including nil
+		uint32_t valueCount;
+		uint32_t valueBytes;
+	};
+
+  private:
+	std::vector<uint32_t> buffer;
+	const uint32_t *external; // memory viewed in place, owned by the caller, or nullptr when buffer is used
+	size_t externalSize;
+
+  private:
+	const uint32_t *Base() const
+	{
+		return external != nullptr ? external : buffer.data();
+	}
+	const Header &Head() const
+	{
+		return *(const Header *)Base();
+	}
+	const Node *Nodes() const
+	{
+		return (const Node *)(Base() + sizeof(Header) / sizeof(uint32_t));
+	}
+	const uint32_t *Offsets() const
+	{
+		return (const uint32_t *)(Nodes() + Head().nodeCount);
+	}
+	const uint32_t *Weights() const
+	{
+		return Offsets() + Head().valueCount + 1;
+	}
+	const char *Data() const
+	{
+		return (const char *)(Weights() + Head().valueCount);
+	}
+	static size_t ByteSize(const Header &header)
+	{
+		size_t bytes = sizeof(Header) + (size_t)header.nodeCount * sizeof(Node) +
+					   ((size_t)header.valueCount * 2 + 1) * sizeof(uint32_t) + header.valueBytes;
+		return (bytes + sizeof(uint32_t) - 1) / sizeof(uint32_t) * sizeof(uint32_t);
+	}
+	// check the header against the size of the memory holding the snapshot
+	static bool CheckHeader(const void *data, size_t size)
+	{
+		if (size < sizeof(Header) || (uintptr_t)data % alignof(uint32_t) != 0)
+		{
+			return false;
+		}
+		const Header &header = *(const Header *)data;
+		return header.magic == MAGIC && header.version == VERSION && header.endian == ENDIAN && header.nodeCount > 0 &&
+			   ByteSize(header) == size;
+	}
+
+  public:
+	CompactRBTrie() : CompactRBTrie(std::vector<Node>(1, Node{0, 0, 0, 0, 0}), {}, {}){};
+	// nodes[0] must be nil and nodes[1] the root, values and weights are referenced by index from the end nodes
+	CompactRBTrie(const std::vector<Node> &nodes, const std::vector<std::string_view> &values,
+				  const std::vector<uint32_t> &weights)
+		: external(nullptr), externalSize(0)
+	{
+		static_assert(sizeof(Node) == 20 && sizeof(Header) % sizeof(uint32_t) == 0);
+		size_t valueBytes = 0;
+		for (const auto &value : values)
+		{
+			valueBytes += value.size();
+		}
+		Header header{MAGIC, VERSION, ENDIAN, (uint32_t)nodes.size(), (uint32_t)values.size(), (uint32_t)valueBytes};
+		buffer.assign(ByteSize(header) / sizeof(uint32_t), 0);
+
+		*(Header *)buffer.data() = header;
+		std::memcpy((void *)Nodes(), nodes.data(), nodes.size() * sizeof(Node));
+		if (!weights.empty())
+		{
+			std::memcpy((void *)Weights(), weights.data(), weights.size() * sizeof(uint32_t));
+		}
+		uint32_t *offsets = (uint32_t *)Offsets();
+		char *data = (char *)Data();
+		offsets[0] = 0;
+		for (size_t i = 0; i < values.size(); ++i)
+		{
+			std::memcpy(data + offsets[i], values[i].data(), values[i].size());
+			offsets[i + 1] = offsets[i] + values[i].size();
+		}
+	}
+	// view a snapshot in memory the caller keeps alive, such as a mapped file, nothing is copied
+	// only the header is checked, call Check before trusting memory that may be corrupted
+	static std::optional<CompactRBTrie> View(const void *data, size_t size)
+	{
+		if (!CheckHeader(data, size))
+		{
+			return std::nullopt;
+		}
+		CompactRBTrie snapshot;
+		snapshot.buffer.clear();
+		snapshot.external = (const uint32_t *)data;
+		snapshot.externalSize = size;
+		return snapshot;
+	}
+	// read a snapshot written by Write, return nullopt if the file is missing or corrupted
+	static std::optional<CompactRBTrie> Read(const std::filesystem::path &path)
+	{
+		std::error_code error;
+		size_t size = std::filesystem::file_size(path, error);
+		std::ifstream fileIn(path, std::ios::in | std::ios::binary);
+		if (error || !fileIn || size % sizeof(uint32_t) != 0)
+		{
+			return std::nullopt;
+		}
+		CompactRBTrie snapshot;
+		snapshot.buffer.assign(size / sizeof(uint32_t), 0);
+		if (!fileIn.read((char *)snapshot.buffer.data(), size) || !CheckHeader(snapshot.buffer.data(), size) ||
+			!snapshot.Check())
+		{
+			return std::nullopt;
+		}
+		return snapshot;
+	}
+	bool Write(const std::filesystem::path &path) const
+	{
+		std::ofstream fileOut(path, std::ios::out | std::ios::binary);
+		return fileOut && fileOut.write((const char *)Bytes(), ByteSize());
+	}
+	// check that every link and value index is in range, that the nodes form a tree in preorder and that no two end
+	// nodes share a value, which removing one of them would free under the other
+	// also check the balancing rules of RBTrie and that lo and hi kids keep codepoint order within a level, as a tree
+	// breaking them loads fine but sends later rotations astray
+	bool Check() const
+	{
+		const Header &header = Head();
+		const Node *nodes = Nodes();
+		std::vector<bool> linked(header.nodeCount, false), owned(header.valueCount, false);
+		std::vector<bool> subroot(header.nodeCount, false);
+		for (uint32_t i = 1; i < header.nodeCount; ++i)
+		{
+			if ((i > 1) != linked[i])
+			{
+				return false;
+			}
+			if (nodes[i].End())
+			{
+				if (nodes[i].value >= header.valueCount || owned[nodes[i].value])
+				{
+					return false;
+				}
+				owned[nodes[i].value] = true;
+			}
+			for (uint32_t kid : {nodes[i].lo, nodes[i].eq, nodes[i].hi})
+			{
+				if (kid != 0 && (kid <= i || kid >= header.nodeCount || linked[kid]))
+				{
+					return false;
+				}
+				linked[kid] = kid != 0;
+			}
+			subroot[nodes[i].eq] = true;
+		}
+		// kids come after their parent in preorder, so walking backward sees every kid first
+		auto red = [nodes](uint32_t id) { return id != 0 && !(nodes[id].bits & BLACK); };
+		std::vector<uint32_t> height(header.nodeCount, 0), lowest(header.nodeCount), highest(header.nodeCount);
+		for (uint32_t i = header.nodeCount - 1; i > 0; --i)
+		{
+			const Node &node = nodes[i];
+			if (red(i) && (i == 1 || subroot[i] || red(node.lo) || red(node.hi)))
+			{
+				return false;
+			}
+			if (height[node.lo] != height[node.hi] || (node.lo != 0 && highest[node.lo] >= node.Codepoint()) ||
+				(node.hi != 0 && lowest[node.hi] <= node.Codepoint()))
+			{
+				return false;
+			}
+			height[i] = height[node.lo] + (red(i) ? 0 : 1);
+			lowest[i] = node.lo != 0 ? lowest[node.lo] : node.Codepoint();
+			highest[i] = node.hi != 0 ? highest[node.hi] : node.Codepoint();
+		}
+		const uint32_t *offsets = Offsets();
+		for (uint32_t i = 0; i < header.valueCount; ++i)
+		{
+			if (offsets[i] > offsets[i + 1])
+			{
+				return false;
+			}
+		}
+		return offsets[0] == 0 && offsets[header.valueCount] == header.valueBytes;
+	}
+	// return the number of node in the snapshot
+	size_t Count() const
+	{
+		return Head().nodeCount - 1;
+	}
+	// the raw snapshot, ready to be written out
+	const void *Bytes() const
+	{
+		return Base();
+	}
+	size_t ByteSize() const
+	{
+		return external != nullptr ? externalSize : buffer.size() * sizeof(uint32_t);
+	}
+	// raw access, for rebuilding a trie from the snapshot
+	const Node &At(uint32_t id) const
+	{
+		return Nodes()[id];
+	}
+	size_t ValueCount() const
+	{
+		return Head().valueCount;
+	}
+	std::string_view Value(uint32_t value) const
+	{
+		const uint32_t *offsets = Offsets();
+		return std::string_view(Data() + offsets[value], offsets[value + 1] - offsets[value]);
+	}
+	uint32_t Weight(uint32_t value) const
+	{
+		return Weights()[value];
+	}
+	// the key must already be normalized the way the trie that produced the snapshot normalizes keys
+	std::optional<std::string_view> Search(std::u32string_view key) const
+	{
+		if (key.empty())
+		{
+			return std::nullopt;
+		}
+		const Node *nodes = Nodes();
+		uint32_t node = Head().nodeCount > 1 ? 1 : 0;
+		size_t pos = 0;
+		while (node != 0)
+		{
+			char32_t codepoint = nodes[node].Codepoint();
+			if (key[pos] < codepoint)
+			{
+				node = nodes[node].lo;
+			}
+			else if (key[pos] > codepoint)
+			{
+				node = nodes[node].hi;
+			}
+			else if (++pos < key.size())
+			{
+				node = nodes[node].eq;
+			}
+			else if (nodes[node].End())
+			{
+				return Value(nodes[node].value);
+			}
+			else
+			{
+				break;
+			}
+		}
+		return std::nullopt;
+	}
+};
@@ -0,0 +1,111 @@
+#pragma once
+#include "left-right.h"
+#include "rbtrie.h"
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+/* Trie shared by many readers and one writer at a time, the two copies are kept by LeftRight.
+ * A change is applied twice and costs twice the memory, but readers never see a tree in the middle of a rotation and
+ * nodes are never freed under their feet, so neither versioned reads nor deferred reclamation are needed.
+ *
+ * Results are copied out of the trie before the read ends, views and cursors must not escape Read.
+ */
+template <typename Trie = RBTrie> class ConcurrentRBTrie
+{
+  private:
+	LeftRight<Trie> tries;
+
+  public:
+	ConcurrentRBTrie() = default;
+	ConcurrentRBTrie(const ConcurrentRBTrie &) = delete;
+	ConcurrentRBTrie &operator=(const ConcurrentRBTrie &) = delete;
+
+	// run visit on the published trie and return its result, see LeftRight::Read
+	template <typename Visit> auto Read(Visit visit) const
+	{
+		return tries.Read(visit);
+	}
+
+	// run change on both copies in turn, see LeftRight::Write
+	template <typename Change> void Write(Change change)
+	{
+		tries.Write(change);
+	}
+
+	long long Count() const
+	{
+		return Read([](const Trie &trie) { return trie.Count(); });
+	}
+
+	long long Size() const
+	{
+		return Read([](const Trie &trie) { return trie.Size(); });
+	}
+
+	void Insert(const std::string &key, const std::string &value, uint32_t weight = 0)
+	{
+		Write([&](Trie &trie) { trie.Insert(key, value, weight); });
+	}
+
+	void Remove(const std::string &key)
+	{
+		Write([&](Trie &trie) { trie.Remove(key); });
+	}
+
+	// replace the content with a range of key/value pairs, see RBTrie::BuildFromSorted
+	template <typename Range> void BuildFromSorted(const Range &entries, unsigned threads = 1)
+	{
+		Write([&](Trie &trie) { trie.BuildFromSorted(entries, threads); });
+	}
+
+	// return a copy of the value of key, or nothing if key is not in the trie
+	std::optional<std::string> Search(std::string_view key) const
+	{
+		return Read([&](const Trie &trie) -> std::optional<std::string> {
+			const std::string *value = trie.Search(key);
+			return value != nullptr ? std::optional<std::string>(*value) : std::nullopt;
+		});
+	}
+
+	std::vector<std::string> PrefixSearch(std::string_view key, size_t limit = SIZE_MAX, size_t offset = 0) const
+	{
+		return Read([&](const Trie &trie) { return trie.PrefixSearch(key, limit, offset); });
+	}
+
+	std::vector<std::string> TopK(std::string_view prefix, size_t k) const
+	{
+		return Read([&](const Trie &trie) { return trie.TopK(prefix, k); });
+	}
+
+	std::string GetKthWord(long long k) const
+	{
+		return Read([&](const Trie &trie) { return trie.GetKthWord(k); });
+	}
+
+	long long Rank(std::string_view key) const
+	{
+		return Read([&](const Trie &trie) { return trie.Rank(key); });
+	}
+
+	bool Save(const std::filesystem::path &path) const
+	{
+		return Read([&](const Trie &trie) { return trie.Save(path); });
+	}
+
+	// load a snapshot written by Save into both copies, nothing changes if the file is missing or corrupted
+	bool Load(const std::filesystem::path &path)
+	{
+		std::optional<CompactRBTrie> snapshot = CompactRBTrie::Read(path);
+		if (!snapshot || !snapshot->Check())
+		{
+			return false;
+		}
+		Write([&](Trie &trie) { trie.Load(*snapshot); });
+		return true;
+	}
+};
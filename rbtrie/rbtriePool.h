@@ -0,0 +1,108 @@
+#pragma once
+#include <cstddef>
+#include <new>
+#include <utility>
+#include <vector>
+
+/* Chunked slab allocator for trie nodes.
+ * Nodes are carved out of large chunks, so building a trie costs one heap allocation per chunk instead of one per
+ * node. Freed nodes go to an intrusive free list and are handed out again before a new chunk is touched.
+ * Clear() releases whole chunks without visiting the nodes in them, so every live node must either be trivially
+ * destructible or have been destroyed already.
+ */
+template <typename T, size_t ChunkSize = 4096> class NodePool
+{
+  private:
+	union Slot
+	{
+		Slot *next;
+		alignas(T) unsigned char storage[sizeof(T)];
+	};
+
+  private:
+	std::vector<Slot *> chunks;
+	Slot *freeList;
+	size_t used; // number of slots handed out from the last chunk
+	size_t live;
+
+  public:
+	NodePool() : freeList(nullptr), used(ChunkSize), live(0){};
+	NodePool(const NodePool &) = delete;
+	NodePool &operator=(const NodePool &) = delete;
+	~NodePool()
+	{
+		Clear();
+	}
+	template <typename... Args> T *Allocate(Args &&...args)
+	{
+		Slot *slot;
+		if (freeList != nullptr)
+		{
+			slot = freeList;
+			freeList = slot->next;
+		}
+		else
+		{
+			if (used == ChunkSize)
+			{
+				chunks.push_back(new Slot[ChunkSize]);
+				used = 0;
+			}
+			slot = &chunks.back()[used];
+			used += 1;
+		}
+		live += 1;
+		return new (slot->storage) T{std::forward<Args>(args)...};
+	}
+	void Free(T *node)
+	{
+		node->~T();
+		Slot *slot = reinterpret_cast<Slot *>(node);
+		slot->next = freeList;
+		freeList = slot;
+		live -= 1;
+	}
+	// release every chunk at once, O(chunks)
+	void Clear()
+	{
+		for (Slot *chunk : chunks)
+		{
+			delete[] chunk;
+		}
+		chunks.clear();
+		freeList = nullptr;
+		used = ChunkSize;
+		live = 0;
+	}
+	// take over every chunk of other, which is left empty; nodes keep their addresses
+	void Splice(NodePool &other)
+	{
+		if (other.chunks.empty())
+		{
+			return;
+		}
+		if (other.freeList != nullptr)
+		{
+			Slot *tail = other.freeList;
+			while (tail->next != nullptr)
+			{
+				tail = tail->next;
+			}
+			tail->next = freeList;
+			freeList = other.freeList;
+		}
+		// the rest of our last chunk is given up, new nodes are carved from the last spliced chunk
+		chunks.insert(chunks.end(), other.chunks.begin(), other.chunks.end());
+		used = other.used;
+		live += other.live;
+		other.chunks.clear();
+		other.freeList = nullptr;
+		other.used = ChunkSize;
+		other.live = 0;
+	}
+	// return the number of live nodes
+	size_t Size() const
+	{
+		return live;
+	}
+};
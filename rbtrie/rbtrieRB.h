@@ -1,8 +1,21 @@
 #pragma once
+#include "rbtrieCompact.h"
+#include "rbtriePool.h"
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <queue>
+#include <span>
 #include <string>
+#include <string_view>
+#include <thread>
 #include <uni_algo/all.h>
 #include <vector>
 
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+#include <xmmintrin.h>
+#endif
+
 /* Adapt red - black balancing rule to ternary search tree:
  * 1. Every node is either red or black.
  * 2. Root is black.
@@ -26,7 +39,9 @@ class RBTrieRB
 
 		bool end;
 		char32_t codepoint;
-		std::string value;
+		uint32_t value; // index into values, only meaningful when end is set
+		uint32_t best;	// heaviest weight of a key in the subtree
+		uint32_t words; // number of keys in the subtree
 
 		Node *lo;
 		Node *eq;
@@ -35,9 +50,15 @@ class RBTrieRB
 	};
 
   private:
+	NodePool<Node> pool;
 	Node *root;
 	Node *const nil;
 
+	// values live outside the nodes, as only the end of a key carries one
+	std::vector<std::string> values;
+	std::vector<uint32_t> weights;
+	std::vector<uint32_t> freeValues;
+
   private:
 	// it is neccessary to have an iterative method for postorder traversal,
 	// as recursive method can't handle long string.
@@ -91,7 +112,8 @@ class RBTrieRB
 		}
 		return node;
 	}
-	Node *InOrderSuccessor(Node *node, std::u32string &str) const
+	// the walk stays inside the subtree rooted at top
+	Node *InOrderSuccessor(Node *node, std::u32string &str, Node *top) const
 	{
 		if (node->eq != nil)
 		{
@@ -102,7 +124,7 @@ class RBTrieRB
 			str.pop_back();
 			return InOrderBegin(node->hi, str);
 		}
-		while (node != nil)
+		while (node != top)
 		{
 			if (node->pa->lo == node)
 			{
@@ -123,6 +145,92 @@ class RBTrieRB
 		str.clear();
 		return nil;
 	}
+	// return the node matching the whole key, or nil
+	// ascii bytes are matched as they are read, only a non-ascii tail is validated and normalized,
+	// so an ascii key is looked up without any allocation
+	Node *Find(std::string_view key, bool &valid) const
+	{
+		valid = !key.empty();
+		Node *node = valid ? root : nil;
+		size_t pos = 0;
+		while (node != nil && pos < key.size() && (unsigned char)key[pos] < 0x80)
+		{
+			if (pos > 0)
+			{
+				node = node->eq;
+			}
+			node = Step(node, NormalizeAscii(key[pos]));
+			pos += 1;
+		}
+		if (pos < key.size())
+		{
+			// an ascii codepoint never combines with what follows it, so the tail normalizes on its own
+			std::string_view tail = key.substr(pos);
+			valid = una::is_valid_utf8(tail);
+			if (!valid)
+			{
+				return nil;
+			}
+			if (node != nil)
+			{
+				node = Match(pos > 0 ? node->eq : node, Normalize(tail));
+			}
+		}
+		return node;
+	}
+	// hint the cpu to start loading a node we are about to visit
+	static void Prefetch(const Node *node)
+	{
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+		_mm_prefetch((const char *)node, _MM_HINT_T0);
+#elif defined(__GNUC__) || defined(__clang__)
+		__builtin_prefetch(node);
+#endif
+	}
+	// find codepoint c in the level tree rooted at node
+	Node *Step(Node *node, char32_t c) const
+	{
+		while (node != nil && c != node->codepoint)
+		{
+			if (c < node->codepoint)
+			{
+				node = node->lo;
+			}
+			else
+			{
+				node = node->hi;
+			}
+		}
+		return node;
+	}
+	// follow str down from the level tree rooted at node, return the node of its last codepoint or nil
+	Node *Match(Node *node, std::u32string_view str) const
+	{
+		for (size_t pos = 0; pos < str.size() && node != nil; ++pos)
+		{
+			if (pos > 0)
+			{
+				node = node->eq;
+			}
+			node = Step(node, str[pos]);
+		}
+		return node;
+	}
+	// rebuild the string of a node by climbing to the root
+	std::u32string KeyOf(Node *node) const
+	{
+		std::u32string str(1, node->codepoint);
+		while (node->pa != nil)
+		{
+			if (node->pa->eq == node)
+			{
+				str += node->pa->codepoint;
+			}
+			node = node->pa;
+		}
+		std::reverse(str.begin(), str.end());
+		return str;
+	}
 	// to get the inorder successor for Remove method
 	Node *Minimum(Node *node) const
 	{
@@ -132,20 +240,45 @@ class RBTrieRB
 		}
 		return node;
 	}
-	void Deallocate(Node *subtree)
+	// reuse the slot of a removed value if there is one
+	uint32_t NewValue(std::string &value, uint32_t weight)
 	{
-		if (subtree == nil)
+		if (freeValues.empty())
 		{
-			return;
+			values.push_back(std::move(value));
+			weights.push_back(weight);
+			return values.size() - 1;
 		}
-		Node *node = PostOrderBegin(subtree);
-		while (node != subtree)
+		uint32_t id = freeValues.back();
+		freeValues.pop_back();
+		values[id] = std::move(value);
+		weights[id] = weight;
+		return id;
+	}
+	void FreeValue(uint32_t id)
+	{
+		std::string().swap(values[id]);
+		weights[id] = 0;
+		freeValues.push_back(id);
+	}
+	// recompute the cached subtree data of node from its kids
+	void Pull(Node *node) const
+	{
+		uint32_t best = node->end ? weights[node->value] : 0;
+		best = std::max(best, node->lo->best);
+		best = std::max(best, node->eq->best);
+		best = std::max(best, node->hi->best);
+		node->best = best;
+		node->words = node->end + node->lo->words + node->eq->words + node->hi->words;
+	}
+	// recompute every node from node up to the root of whatever tree it is attached to
+	void PullPath(Node *node) const
+	{
+		while (node != nil)
 		{
-			Node *next = PostOrderSuccessor(node);
-			delete node;
-			node = next;
+			Pull(node);
+			node = node->pa;
 		}
-		delete node;
 	}
 	// aka left rotate
 	// root can be changed, so we return the new root
@@ -174,6 +307,8 @@ class RBTrieRB
 		}
 		kid->lo = node;
 		node->pa = kid;
+		Pull(node);
+		Pull(kid);
 		return rt;
 	}
 	// aka right rotate
@@ -203,6 +338,8 @@ class RBTrieRB
 		}
 		kid->hi = node;
 		node->pa = kid;
+		Pull(node);
+		Pull(kid);
 		return rt;
 	}
 	// this algorithm is taken from clrs book
@@ -357,11 +494,12 @@ class RBTrieRB
 	// this algorithm is taken from clrs book
 	// assume subtree is detached
 	// root can be changed, so we return the new root
-	Node *RemoveUpdate(Node *rt, Node *node) const
+	Node *RemoveUpdate(Node *rt, Node *node)
 	{
 		Node *del = node;
 		Node::Color del_original_color = del->color;
 		Node *violation;
+		Node *moved = nil; // lowest node that lost a key when del moved up
 		if (node->lo == nil)
 		{
 			violation = node->hi;
@@ -377,6 +515,7 @@ class RBTrieRB
 			del = Minimum(node->hi);
 			del_original_color = del->color;
 			violation = del->hi;
+			moved = del->pa;
 			if (del != node->hi)
 			{
 				rt = Transplant(rt, del, del->hi);
@@ -385,6 +524,7 @@ class RBTrieRB
 			}
 			else
 			{
+				moved = del;
 				violation->pa = del;
 			}
 			rt = Transplant(rt, node, del);
@@ -392,7 +532,8 @@ class RBTrieRB
 			del->lo->pa = del;
 			del->color = node->color;
 		}
-		delete node;
+		pool.Free(node);
+		PullPath(moved);
 		if (del_original_color == Node::BLACK)
 		{
 			rt = RemoveFixup(rt, violation);
@@ -428,30 +569,26 @@ class RBTrieRB
 			pa->eq->pa = pa;
 		}
 	}
-	Node *AddTail(Node *node, std::u32string &str, int pos, std::string &value)
+	Node *AddTail(Node *node, std::u32string &str, int pos, std::string &value, uint32_t weight)
 	{
 		while (pos < str.size())
 		{
-			node->eq = new Node{Node::BLACK, true, false, str[pos], "", nil, nil, nil, node};
+			node->eq = pool.Allocate(Node::BLACK, true, false, str[pos], 0u, 0u, 0u, nil, nil, nil, node);
 			node = node->eq;
 			pos += 1;
 		}
-		node->end = true;
-		node->value = value;
-		return node;
-	}
-	// iterative method, as recursive can't handle long string
-	long long Count(Node *node) const
-	{
-		long long cnt = 0;
-		Node *iter = PostOrderBegin(node);
-		while (iter != node)
+		if (node->end)
 		{
-			cnt += 1;
-			iter = PostOrderSuccessor(iter);
+			values[node->value] = std::move(value);
+			weights[node->value] = weight;
 		}
-		cnt += (node != nil);
-		return cnt;
+		else
+		{
+			node->end = true;
+			node->value = NewValue(value, weight);
+		}
+		PullPath(node);
+		return node;
 	}
 	// this is just to test the correctness of the tree, will be Removed
 	// int Validate(Node *node) const
@@ -503,59 +640,394 @@ class RBTrieRB
 	//	Validate(node->eq);
 	//	return lobh + (node->color == Node::BLACK);
 	//}
-	void Collect(Node *node, std::u32string &str, std::vector<std::string> &collection)
+	// return the first node of the subtree rooted at top whose string is greater than key,
+	// top hangs below the first depth codepoints of key, str receives the path of the returned node
+	Node *UpperBound(Node *top, std::u32string_view key, size_t depth, std::u32string &str) const
 	{
-		Node *pa = node->pa;
-		node->pa = nil; // detach subtree for traversal
-		Node *cur = InOrderBegin(node, str);
-		while (cur != nil)
+		Node *next = nil; // first node after everything passed so far
+		size_t nextDepth = 0;
+		Node *node = top;
+		while (node != nil && depth < key.size())
 		{
-			if (cur->end)
+			if (key[depth] < node->codepoint)
+			{
+				next = node;
+				nextDepth = depth;
+				node = node->lo;
+			}
+			else if (key[depth] > node->codepoint)
 			{
-				collection.push_back(una::norm::to_nfc_utf8(una::utf32to8(str)));
+				node = node->hi;
+			}
+			else if (depth + 1 == key.size())
+			{
+				str.assign(key);
+				return InOrderSuccessor(node, str, top);
+			}
+			else
+			{
+				if (node->hi != nil)
+				{
+					next = Minimum(node->hi);
+					nextDepth = depth;
+				}
+				node = node->eq;
+				depth += 1;
 			}
-			cur = InOrderSuccessor(cur, str);
 		}
-		node->pa = pa;
+		if (next != nil)
+		{
+			str.assign(key.substr(0, nextDepth));
+			str += next->codepoint;
+		}
+		return next;
 	}
+	// keys in [first, last) of a bulk load share their first depth codepoints, which lead to pa
+	struct BulkLevel
+	{
+		uint32_t first;
+		uint32_t last;
+		uint32_t depth;
+		Node *pa;
+	};
+	// build the levels on the stack with nodes from nodes, keys are distinct and sorted, key i gets value i
+	// levels holding at most grain keys are moved to deferred instead, when it is given
+	// iterative method, as recursive can't handle long string
+	void BuildLevels(const std::vector<std::u32string_view> &keys, NodePool<Node> &nodes,
+					 std::vector<BulkLevel> &levels, std::vector<BulkLevel> *deferred = nullptr, size_t grain = 0)
+	{
+		// groups in [lo, hi) of the current level hang from pa
+		struct Span
+		{
+			uint32_t lo;
+			uint32_t hi;
+			uint32_t depth;
+			Node *pa;
+			Node *Node::*link;
+		};
+		std::vector<Span> spans;
+		std::vector<uint32_t> groups;
+		while (!levels.empty())
+		{
+			BulkLevel level = levels.back();
+			levels.pop_back();
+			if (deferred != nullptr && level.last - level.first <= grain)
+			{
+				deferred->push_back(level);
+				continue;
+			}
+			uint32_t i = level.first;
+			if (keys[i].size() == level.depth)
+			{
+				level.pa->end = true;
+				level.pa->value = i;
+				i += 1;
+			}
+			if (i == level.last)
+			{
+				continue;
+			}
+			if (i + 1 == level.last)
+			{
+				// a lone key hangs as a chain of subroots, like AddTail does
+				Node *pa = level.pa;
+				for (size_t pos = level.depth; pos < keys[i].size(); ++pos)
+				{
+					Node *node = nodes.Allocate(Node::BLACK, true, false, keys[i][pos], 0u, 0u, 1u, nil, nil, nil, pa);
+					(pa != nil ? pa->eq : root) = node;
+					pa = node;
+				}
+				pa->end = true;
+				pa->value = i;
+				continue;
+			}
+
+			// one group per distinct codepoint at this depth
+			groups.clear();
+			groups.push_back(i);
+			for (uint32_t j = i + 1; j < level.last; ++j)
+			{
+				if (keys[j][level.depth] != keys[j - 1][level.depth])
+				{
+					groups.push_back(j);
+				}
+			}
+			groups.push_back(level.last);
+			uint32_t size = groups.size() - 1;
+			uint32_t height = 0;
+			while ((2u << height) <= size)
+			{
+				height += 1;
+			}
+			bool full = size == (2u << height) - 1;
+
+			spans.push_back({0, size, 0, level.pa, nullptr});
+			while (!spans.empty())
+			{
+				Span span = spans.back();
+				spans.pop_back();
+				uint32_t mid = (span.lo + span.hi) / 2;
+				// all weights are 0, so best is 0 everywhere and words is the number of keys below
+				Node *node = nodes.Allocate(span.depth == height && !full ? Node::RED : Node::BLACK, span.depth == 0,
+											false, keys[groups[mid]][level.depth], 0u, 0u,
+											groups[span.hi] - groups[span.lo], nil, nil, nil, span.pa);
+				if (span.link != nullptr)
+				{
+					span.pa->*span.link = node;
+				}
+				else
+				{
+					(span.pa != nil ? span.pa->eq : root) = node;
+				}
+				levels.push_back({groups[mid], groups[mid + 1], level.depth + 1, node});
+				if (span.lo < mid)
+				{
+					spans.push_back({span.lo, mid, span.depth + 1, node, &Node::lo});
+				}
+				if (mid + 1 < span.hi)
+				{
+					spans.push_back({mid + 1, span.hi, span.depth + 1, node, &Node::hi});
+				}
+			}
+		}
+	}
+	// run work(thread, first, last) over [0, count) split into one contiguous chunk per thread
+	template <typename Work> static void ParallelFor(unsigned threads, size_t count, Work work)
+	{
+		threads = std::max<size_t>(1, std::min<size_t>(threads, count));
+		std::vector<std::thread> workers;
+		for (unsigned t = 1; t < threads; ++t)
+		{
+			workers.emplace_back(work, t, count * t / threads, count * (t + 1) / threads);
+		}
+		work(0u, (size_t)0, count / threads);
+		for (auto &worker : workers)
+		{
+			worker.join();
+		}
+	}
+
+  public:
+	// walk the completions of a prefix in sorted order, one at a time
+	// the cursor is invalidated by any modification of the tree
+	class PrefixCursor
+	{
+	  private:
+		friend class RBTrieRB;
+		const RBTrieRB *trie;
+		Node *top; // the walk never leaves the subtree below the prefix
+		Node *cur; // next node to look at
+		std::u32string str;
+		size_t prefixSize;
+		bool prefixPending; // the prefix itself is a key and has not been returned yet
+		std::string token;
+
+	  private:
+		PrefixCursor(const RBTrieRB *trie)
+			: trie(trie), top(trie->nil), cur(trie->nil), prefixSize(0), prefixPending(false){};
+
+	  public:
+		// move to the next completion, return false once there is none left
+		bool Next(std::string &word)
+		{
+			if (prefixPending)
+			{
+				prefixPending = false;
+				token = una::utf32to8(std::u32string_view(str).substr(0, prefixSize));
+				word = una::norm::to_nfc_utf8(token);
+				return true;
+			}
+			while (cur != trie->nil)
+			{
+				Node *node = cur;
+				if (node->end)
+				{
+					token = una::utf32to8(str);
+				}
+				cur = trie->InOrderSuccessor(cur, str, top);
+				if (node->end)
+				{
+					word = una::norm::to_nfc_utf8(token);
+					return true;
+				}
+			}
+			return false;
+		}
+		// opaque token to resume after the last completion returned, even if the tree changed in between
+		const std::string &Token() const
+		{
+			return token;
+		}
+	};
+
+	// outcome of a lookup, value views into the tree and stays valid until the tree is modified
+	struct SearchResult
+	{
+		enum Status : char
+		{
+			FOUND = 0,
+			NOT_FOUND,
+			INVALID_KEY
+		} status;
+		std::string_view value;
+
+		explicit operator bool() const
+		{
+			return status == FOUND;
+		}
+	};
 
   public:
+	// turn a valid utf-8 key into the codepoint sequence stored in the tree, keys are case-insensitive
+	static std::u32string Normalize(std::string_view key)
+	{
+		return una::utf8to32u(una::norm::to_nfd_utf8(una::cases::to_lowercase_utf8(key)));
+	}
+	// the codepoint Normalize turns an ascii character into
+	static char32_t NormalizeAscii(char c)
+	{
+		return c >= 'A' && c <= 'Z' ? c - 'A' + 'a' : c;
+	}
 	// nil's attributes can only be changed during update process
 	// after update process, nil's attributes must be restored
-	RBTrieRB() : nil(new Node{Node::BLACK, false, false, 0, "", nullptr, nullptr, nullptr, nullptr})
+	RBTrieRB() : nil(new Node{Node::BLACK, false, false, 0, 0, 0, 0, nullptr, nullptr, nullptr, nullptr})
 	{
 		nil->lo = nil->eq = nil->hi = nil->pa = nil;
 		root = nil;
 	}
 	~RBTrieRB()
 	{
-		Deallocate(root);
 		delete nil;
 	}
-	// iterative method, as recursive can't handle long string
+	// nodes hold no resources, so the pool drops them chunk by chunk without walking the tree
 	void Clear()
 	{
-		Deallocate(root);
+		pool.Clear();
+		values.clear();
+		weights.clear();
+		freeValues.clear();
 		root = nil;
 	}
 	// return the number of node in the tree
 	long long Count() const
 	{
-		return Count(root);
+		return pool.Size();
+	}
+	// return the number of string in the tree
+	long long Size() const
+	{
+		return root->words;
+	}
+	// replace the content of the tree with a range of key/value pairs, building every level directly instead of
+	// inserting key by key: each lo/hi tree is split at the middle, so it is balanced, and only its deepest level is
+	// red when that level is not full, which satisfies the rules above without any rotation
+	// keys are expected sorted by their normalized form and get sorted here otherwise; for equal keys the last wins
+	// with more than one thread, keys are normalized in parallel, and once the top levels have split the keys into
+	// small enough ranges, the subtrees below are built in parallel into private pools spliced in at the end
+	// entries must stay alive and unchanged during the call
+	template <typename Range> void BuildFromSorted(const Range &entries, unsigned threads = 1)
+	{
+		Clear();
+		std::vector<std::string_view> rawKeys, rawValues;
+		for (const auto &[key, value] : entries)
+		{
+			rawKeys.emplace_back(key);
+			rawValues.emplace_back(value);
+		}
+		threads = std::max(threads, 1u);
+
+		// normalized keys back to back, one buffer per thread, invalid keys are left empty
+		std::vector<std::u32string_view> normalized(rawKeys.size());
+		std::vector<std::u32string> chars(threads);
+		ParallelFor(threads, rawKeys.size(), [&](unsigned t, size_t first, size_t last) {
+			std::vector<size_t> offsets(1, 0);
+			for (size_t i = first; i < last; ++i)
+			{
+				if (!rawKeys[i].empty() && una::is_valid_utf8(rawKeys[i]))
+				{
+					chars[t] += Normalize(rawKeys[i]);
+				}
+				offsets.push_back(chars[t].size());
+			}
+			for (size_t i = first; i < last; ++i)
+			{
+				size_t offset = offsets[i - first];
+				normalized[i] = std::u32string_view(chars[t]).substr(offset, offsets[i - first + 1] - offset);
+			}
+		});
+
+		std::vector<uint32_t> order;
+		bool sorted = true;
+		for (uint32_t i = 0; i < normalized.size(); ++i)
+		{
+			if (!normalized[i].empty())
+			{
+				sorted = sorted && (order.empty() || normalized[order.back()] <= normalized[i]);
+				order.push_back(i);
+			}
+		}
+		if (!sorted)
+		{
+			std::stable_sort(order.begin(), order.end(),
+							 [&](uint32_t a, uint32_t b) { return normalized[a] < normalized[b]; });
+		}
+		// keep only the last of equal keys, so every key range counts distinct keys, then key i gets value i
+		std::vector<std::u32string_view> keys;
+		for (size_t i = 0; i < order.size(); ++i)
+		{
+			if (i + 1 == order.size() || normalized[order[i]] != normalized[order[i + 1]])
+			{
+				keys.push_back(normalized[order[i]]);
+				values.emplace_back(rawValues[order[i]]);
+			}
+		}
+		weights.assign(keys.size(), 0);
+
+		std::vector<BulkLevel> levels;
+		if (!keys.empty())
+		{
+			levels.push_back({0, (uint32_t)keys.size(), 0, nil});
+		}
+		if (threads == 1)
+		{
+			BuildLevels(keys, pool, levels);
+			return;
+		}
+
+		// the top levels are built here until they are split finely enough to keep every thread busy
+		std::vector<BulkLevel> deferred;
+		BuildLevels(keys, pool, levels, &deferred, std::max<size_t>(1, keys.size() / (threads * 8)));
+		std::sort(deferred.begin(), deferred.end(), [](const BulkLevel &a, const BulkLevel &b) {
+			return a.last - a.first > b.last - b.first;
+		});
+		std::vector<NodePool<Node>> pools(threads);
+		std::atomic<size_t> next = 0;
+		ParallelFor(threads, threads, [&](unsigned t, size_t, size_t) {
+			std::vector<BulkLevel> stack;
+			for (size_t i = next++; i < deferred.size(); i = next++)
+			{
+				stack.push_back(deferred[i]);
+				BuildLevels(keys, pools[t], stack);
+			}
+		});
+		for (auto &other : pools)
+		{
+			pool.Splice(other);
+		}
 	}
 	// iterative method, as recursive can't handle long string
-	Node *Insert(std::string key, std::string value)
+	// weight ranks the key in TopK, inserting an existing key replaces both its value and its weight
+	Node *Insert(std::string key, std::string value, uint32_t weight = 0)
 	{
 		if (key.empty() || !una::is_valid_utf8(key))
 		{
 			return nil;
 		}
 		Node *end = nil;
-		key = una::cases::to_lowercase_utf8(key);
-		std::u32string str = una::utf8to32u(una::norm::to_nfd_utf8(key));
+		std::u32string str = Normalize(key);
 		if (root == nil)
 		{
-			end = AddTail(nil, str, 0, value);
+			end = AddTail(nil, str, 0, value, weight);
 			root = nil->eq;
 			nil->eq = nil;
 			return end;
@@ -575,8 +1047,8 @@ class RBTrieRB
 					}
 					else
 					{
-						node->lo = new Node{Node::RED, false, false, str[pos], "", nil, nil, nil, node};
-						end = AddTail(node->lo, str, pos + 1, value);
+						node->lo = pool.Allocate(Node::RED, false, false, str[pos], 0u, 0u, 0u, nil, nil, nil, node);
+						end = AddTail(node->lo, str, pos + 1, value, weight);
 						InsertUpdate(rt, node->lo);
 						return end;
 					}
@@ -589,8 +1061,8 @@ class RBTrieRB
 					}
 					else
 					{
-						node->hi = new Node{Node::RED, false, false, str[pos], "", nil, nil, nil, node};
-						end = AddTail(node->hi, str, pos + 1, value);
+						node->hi = pool.Allocate(Node::RED, false, false, str[pos], 0u, 0u, 0u, nil, nil, nil, node);
+						end = AddTail(node->hi, str, pos + 1, value, weight);
 						InsertUpdate(rt, node->hi);
 						return end;
 					}
@@ -604,7 +1076,7 @@ class RBTrieRB
 			}
 			else
 			{
-				end = AddTail(node, str, pos, value);
+				end = AddTail(node, str, pos, value, weight);
 				return end;
 			}
 		}
@@ -616,8 +1088,7 @@ class RBTrieRB
 		{
 			return;
 		}
-		key = una::cases::to_lowercase_utf8(key);
-		std::u32string str = una::utf8to32u(una::norm::to_nfd_utf8(key));
+		std::u32string str = Normalize(key);
 		int pos = -1;
 		nil->eq = root;
 		Node *node = nil;
@@ -643,11 +1114,17 @@ class RBTrieRB
 			}
 		}
 		nil->eq = nil;
+		if (!node->end)
+		{
+			return;
+		}
 		node->end = false;
+		FreeValue(node->value);
+		PullPath(node);
 		while (node->subroot && !node->end && node->eq == nil && node->lo == nil && node->hi == nil)
 		{
 			Node *pa = node->pa;
-			delete node;
+			pool.Free(node);
 			node = pa;
 			node->eq = nil;
 		}
@@ -677,113 +1154,425 @@ class RBTrieRB
 			pa->eq->pa = pa;
 		}
 	}
-	// i believe we should not return error code string, instead
-	// we should return an empty string and an error code elsewhere
-	std::string Search(std::string key) const
+	// return the value of key, or nullptr if key is not in the tree
+	// the pointer stays valid until the tree is modified
+	const std::string *Search(std::string_view key) const
 	{
-		if (key.empty() || !una::is_valid_utf8(key))
+		bool valid;
+		Node *node = Find(key, valid);
+		return node != nil && node->end ? &values[node->value] : nullptr;
+	}
+	// same as Search, but also tell an invalid key apart from a missing one
+	SearchResult Lookup(std::string_view key) const
+	{
+		bool valid;
+		Node *node = Find(key, valid);
+		if (!valid)
 		{
-			return (const char *)u8"Invalid key";
+			return {SearchResult::INVALID_KEY, {}};
 		}
-		key = una::cases::to_lowercase_utf8(key);
-		std::u32string str = una::utf8to32u(una::norm::to_nfd_utf8(key));
-		Node *node = root;
-		int pos = 0;
-		while (pos < str.size())
+		if (node == nil || !node->end)
 		{
-			while (node != nil && str[pos] != node->codepoint)
+			return {SearchResult::NOT_FOUND, {}};
+		}
+		return {SearchResult::FOUND, values[node->value]};
+	}
+	// look up many keys at once, the i-th result belongs to the i-th key
+	// a group of descents advance in turn, one node each, and the next node of each is prefetched,
+	// so the cache misses of the whole group overlap instead of being paid one after another
+	std::vector<SearchResult> SearchBatch(std::span<const std::string_view> keys) const
+	{
+		const size_t GROUP = 16;
+		struct Descent
+		{
+			size_t key;
+			size_t pos;
+			Node *node;
+		};
+		std::vector<SearchResult> results(keys.size(), SearchResult{SearchResult::NOT_FOUND, {}});
+		Descent group[GROUP];
+		size_t active = 0;
+		size_t next = 0;
+		while (active > 0 || next < keys.size())
+		{
+			while (active < GROUP && next < keys.size())
 			{
-				if (str[pos] < node->codepoint)
+				std::string_view key = keys[next];
+				if (key.empty() || (unsigned char)key[0] >= 0x80 || root == nil)
 				{
-					node = node->lo;
+					results[next] = Lookup(key);
 				}
 				else
 				{
-					node = node->hi;
+					Prefetch(root);
+					group[active] = {next, 0, root};
+					active += 1;
 				}
+				next += 1;
 			}
-			if (node == nil)
-			{
-				return (const char *)u8"Key not found";
-			}
-			pos += 1;
-			if (pos < str.size())
+			size_t i = 0;
+			while (i < active)
 			{
-				node = node->eq;
+				Descent &cur = group[i];
+				std::string_view key = keys[cur.key];
+				char32_t c = NormalizeAscii(key[cur.pos]);
+				bool done = false;
+				if (c < cur.node->codepoint)
+				{
+					cur.node = cur.node->lo;
+				}
+				else if (c > cur.node->codepoint)
+				{
+					cur.node = cur.node->hi;
+				}
+				else if (cur.pos + 1 == key.size())
+				{
+					if (cur.node->end)
+					{
+						results[cur.key] = {SearchResult::FOUND, values[cur.node->value]};
+					}
+					done = true;
+				}
+				else if ((unsigned char)key[cur.pos + 1] >= 0x80)
+				{
+					// rare non-ascii tail, take the normalizing path
+					results[cur.key] = Lookup(key);
+					done = true;
+				}
+				else
+				{
+					cur.pos += 1;
+					cur.node = cur.node->eq;
+				}
+				if (done || cur.node == nil)
+				{
+					// a descent that fell off the tree has not seen the rest of the key, which may be invalid
+					if (!done && !std::all_of(key.begin() + cur.pos, key.end(),
+											  [](char c) { return (unsigned char)c < 0x80; }))
+					{
+						results[cur.key] = Lookup(key);
+					}
+					active -= 1;
+					cur = group[active];
+					continue;
+				}
+				Prefetch(cur.node);
+				i += 1;
 			}
-			else if (!node->end)
+		}
+		return results;
+	}
+	// same as Search(std::string_view), for a key that is already normalized
+	const std::string *Search(std::u32string_view key) const
+	{
+		if (key.empty())
+		{
+			return nullptr;
+		}
+		Node *node = Match(root, key);
+		return node != nil && node->end ? &values[node->value] : nullptr;
+	}
+	// start walking the completions of prefix, or those after token if it comes from an earlier cursor
+	PrefixCursor PrefixBegin(std::string_view prefix, std::string_view token = {}) const
+	{
+		PrefixCursor cursor(this);
+		if (prefix.empty() || !una::is_valid_utf8(prefix) || !una::is_valid_utf8(token))
+		{
+			return cursor;
+		}
+		std::u32string str = Normalize(prefix);
+		Node *node = Match(root, str);
+		if (node == nil)
+		{
+			return cursor;
+		}
+		cursor.top = node->eq;
+		cursor.prefixSize = str.size();
+		std::u32string after = una::utf8to32u(token);
+		if (token.empty() || !after.starts_with(str))
+		{
+			cursor.prefixPending = node->end;
+			cursor.str = str;
+			cursor.cur = InOrderBegin(cursor.top, cursor.str);
+		}
+		else if (after.size() == str.size())
+		{
+			cursor.str = str;
+			cursor.cur = InOrderBegin(cursor.top, cursor.str);
+		}
+		else
+		{
+			cursor.cur = UpperBound(cursor.top, after, str.size(), cursor.str);
+		}
+		return cursor;
+	}
+	// find the strings that have certain prefix, in sorted order, skipping the first offset of them
+	// and returning at most limit
+	std::vector<std::string> PrefixSearch(std::string_view key, size_t limit = SIZE_MAX, size_t offset = 0) const
+	{
+		std::vector<std::string> collection;
+		PrefixCursor cursor = PrefixBegin(key);
+		std::string word;
+		while (collection.size() < limit && cursor.Next(word))
+		{
+			if (offset > 0)
 			{
-				return (const char *)u8"Key not found";
+				offset -= 1;
 			}
 			else
 			{
-				return node->value;
+				collection.push_back(std::move(word));
 			}
 		}
+		return collection;
 	}
-	// find all string that have certain prefix
-	std::vector<std::string> PrefixSearch(std::string key)
+	// find the k heaviest strings that have certain prefix, heaviest first
+	// best-first search guided by the heaviest weight cached in every node, so only the branches
+	// that lead to the answer are expanded instead of the whole subtree
+	std::vector<std::string> TopK(std::string_view prefix, size_t k) const
 	{
-		if (key.empty() || !una::is_valid_utf8(key))
+		struct Candidate
+		{
+			uint32_t weight;
+			Node *node;
+			bool subtree; // the whole subtree of node, or only the key ending at node
+
+			bool operator<(const Candidate &other) const
+			{
+				return weight < other.weight;
+			}
+		};
+		if (prefix.empty() || !una::is_valid_utf8(prefix))
 		{
 			return {};
 		}
-		key = una::cases::to_lowercase_utf8(key);
-		std::u32string str = una::utf8to32u(una::norm::to_nfd_utf8(key));
-		Node *node = root;
-		int pos = 0;
-		while (pos < str.size())
+		Node *node = Match(root, Normalize(prefix));
+		if (node == nil)
 		{
-			while (node != nil && str[pos] != node->codepoint)
+			return {};
+		}
+		std::vector<std::string> collection;
+		std::priority_queue<Candidate> queue;
+		if (node->end)
+		{
+			queue.push({weights[node->value], node, false});
+		}
+		if (node->eq != nil)
+		{
+			queue.push({node->eq->best, node->eq, true});
+		}
+		while (!queue.empty() && collection.size() < k)
+		{
+			Candidate top = queue.top();
+			queue.pop();
+			node = top.node;
+			if (!top.subtree)
 			{
-				if (str[pos] < node->codepoint)
-				{
-					node = node->lo;
-				}
-				else
+				collection.push_back(una::norm::to_nfc_utf8(una::utf32to8(KeyOf(node))));
+				continue;
+			}
+			if (node->end)
+			{
+				queue.push({weights[node->value], node, false});
+			}
+			for (Node *kid : {node->lo, node->eq, node->hi})
+			{
+				if (kid != nil)
 				{
-					node = node->hi;
+					queue.push({kid->best, kid, true});
 				}
 			}
-			if (node == nil)
+		}
+		return collection;
+	}
+	// get the k-th string in the tree, counting from 1
+	// the key counts cached in the nodes let us skip whole subtrees, so this is O(depth)
+	std::string GetKthWord(long long k) const
+	{
+		std::u32string word;
+		if (k < 1 || k > Size())
+		{
+			return {};
+		}
+		Node *node = root;
+		while (node != nil)
+		{
+			if (k <= node->lo->words)
 			{
-				return {};
+				node = node->lo;
+				continue;
 			}
-			pos += 1;
-			if (pos < str.size())
+			k -= node->lo->words;
+			if (node->end && k == 1)
+			{
+				word += node->codepoint;
+				break;
+			}
+			k -= node->end;
+			if (k <= node->eq->words)
+			{
+				word += node->codepoint;
+				node = node->eq;
+				continue;
+			}
+			k -= node->eq->words;
+			node = node->hi;
+		}
+		return una::norm::to_nfc_utf8(una::utf32to8(word));
+	}
+	// get the position of key in sorted order, counting from 1, or 0 if key is not in the tree
+	long long Rank(std::string_view key) const
+	{
+		if (key.empty() || !una::is_valid_utf8(key))
+		{
+			return 0;
+		}
+		std::u32string str = Normalize(key);
+		long long rank = 0;
+		Node *node = root;
+		size_t pos = 0;
+		while (node != nil)
+		{
+			if (str[pos] < node->codepoint)
+			{
+				node = node->lo;
+			}
+			else if (str[pos] > node->codepoint)
 			{
+				rank += node->lo->words + node->end + node->eq->words;
+				node = node->hi;
+			}
+			else if (pos + 1 < str.size())
+			{
+				rank += node->lo->words + node->end;
 				node = node->eq;
+				pos += 1;
 			}
 			else
 			{
-				std::vector<std::string> collection;
-				if (node->end)
-				{
-					collection.push_back(una::norm::to_nfc_utf8(una::utf32to8(str)));
-				}
-				Collect(node->eq, str, collection);
-				return collection;
+				return node->end ? rank + node->lo->words + 1 : 0;
 			}
 		}
+		return 0;
 	}
-	// get the k-th string in the tree
-	std::string GetKthWord(int k)
+
+	// copy the tree into a read-only snapshot with 32-bit links, nodes are laid out in preorder
+	// iterative method, as recursive can't handle long string
+	CompactRBTrie Compact() const
 	{
-		std::u32string word;
-		Node *cur = InOrderBegin(root, word);
-		if (cur->end)
+		struct Pending
 		{
-			k--;
+			Node *node;
+			uint32_t pa;
+			uint32_t CompactRBTrie::Node::*link;
+		};
+		std::vector<CompactRBTrie::Node> nodes(1, CompactRBTrie::Node{0, 0, 0, 0, 0});
+		std::vector<std::string_view> snapshotValues;
+		std::vector<uint32_t> snapshotWeights;
+		std::vector<Pending> stack;
+		if (root != nil)
+		{
+			stack.push_back({root, 0, nullptr});
 		}
-		while (cur != nil && k > 0)
+		while (!stack.empty())
 		{
-			cur = InOrderSuccessor(cur, word);
-			if (cur->end)
+			Pending cur = stack.back();
+			stack.pop_back();
+			uint32_t id = nodes.size();
+			if (cur.link != nullptr)
+			{
+				nodes[cur.pa].*cur.link = id;
+			}
+			Node *node = cur.node;
+			uint32_t bits = node->codepoint;
+			bits |= node->color == Node::BLACK ? CompactRBTrie::BLACK : 0;
+			bits |= node->subroot ? CompactRBTrie::SUBROOT : 0;
+			bits |= node->end ? CompactRBTrie::END : 0;
+			uint32_t value = 0;
+			if (node->end)
 			{
-				k--;
+				value = snapshotValues.size();
+				snapshotValues.push_back(values[node->value]);
+				snapshotWeights.push_back(weights[node->value]);
+			}
+			nodes.push_back(CompactRBTrie::Node{bits, value, 0, 0, 0});
+			if (node->hi != nil)
+			{
+				stack.push_back({node->hi, id, &CompactRBTrie::Node::hi});
+			}
+			if (node->eq != nil)
+			{
+				stack.push_back({node->eq, id, &CompactRBTrie::Node::eq});
+			}
+			if (node->lo != nil)
+			{
+				stack.push_back({node->lo, id, &CompactRBTrie::Node::lo});
 			}
 		}
-		return una::norm::to_nfc_utf8(una::utf32to8(word));
+		return CompactRBTrie(nodes, snapshotValues, snapshotWeights);
+	}
+	// replace the content of the tree with a snapshot taken by Compact, in one linear pass without any rotation
+	// the snapshot must come from the same kind of trie, as keys are not normalized again
+	bool Load(const CompactRBTrie &snapshot)
+	{
+		if (!snapshot.Check())
+		{
+			return false;
+		}
+		Clear();
+		values.reserve(snapshot.ValueCount());
+		weights.reserve(snapshot.ValueCount());
+		for (uint32_t i = 0; i < snapshot.ValueCount(); ++i)
+		{
+			values.emplace_back(snapshot.Value(i));
+			weights.push_back(snapshot.Weight(i));
+		}
+		// allocating in snapshot order keeps the preorder layout in memory
+		std::vector<Node *> nodes(snapshot.Count() + 1, nil);
+		for (uint32_t i = 1; i < nodes.size(); ++i)
+		{
+			const CompactRBTrie::Node &packed = snapshot.At(i);
+			nodes[i] = pool.Allocate(packed.bits & CompactRBTrie::BLACK ? Node::BLACK : Node::RED, i == 1, packed.End(),
+									 packed.Codepoint(), packed.End() ? packed.value : 0u, 0u, 0u, nil, nil, nil, nil);
+		}
+		for (uint32_t i = 1; i < nodes.size(); ++i)
+		{
+			const CompactRBTrie::Node &packed = snapshot.At(i);
+			Node *node = nodes[i];
+			node->lo = nodes[packed.lo];
+			node->eq = nodes[packed.eq];
+			node->hi = nodes[packed.hi];
+			// the subroots are the root and the eq kids, whatever the snapshot says
+			if (node->eq != nil)
+			{
+				node->eq->subroot = true;
+			}
+			for (Node *kid : {node->lo, node->eq, node->hi})
+			{
+				if (kid != nil)
+				{
+					kid->pa = node;
+				}
+			}
+		}
+		// nodes are in preorder, so walking them backward pulls every kid before its parent
+		for (uint32_t i = nodes.size() - 1; i > 0; --i)
+		{
+			Pull(nodes[i]);
+		}
+		root = nodes.size() > 1 ? nodes[1] : nil;
+		return true;
+	}
+	// write a snapshot of the tree, see Compact
+	bool Save(const std::filesystem::path &path) const
+	{
+		return Compact().Write(path);
+	}
+	// load a snapshot written by Save, the tree is left untouched if the file is missing or corrupted
+	bool Load(const std::filesystem::path &path)
+	{
+		std::optional<CompactRBTrie> snapshot = CompactRBTrie::Read(path);
+		return snapshot && Load(*snapshot);
 	}
 
 	// this is just to test the correctness of the tree, will be removed
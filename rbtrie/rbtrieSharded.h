@@ -0,0 +1,246 @@
+#pragma once
+#include "rbtrie.h"
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <shared_mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <utility>
+#include <vector>
+
+/* Several independent tries, each owning a range of first codepoints, so writers on different ranges never meet.
+ * Every shard has its own reader-writer lock: an Insert or Remove only locks the shard of its key, lookups share it.
+ * Keys are routed by the first codepoint of their normalized form, and ranges are contiguous and in increasing order,
+ * so the sorted order of all keys is the shards one after another:
+ * - prefix queries only ever touch the shard of the prefix,
+ * - GetKthWord and Rank skip whole shards by their sizes.
+ * Queries spanning shards lock them one at a time, so they are not atomic with respect to concurrent writes.
+ *
+ * Results are copied out of the trie before the lock is released.
+ */
+template <typename Trie = RBTrie> class ShardedRBTrie
+{
+  private:
+	struct Shard
+	{
+		Trie trie;
+		mutable std::shared_mutex lock;
+	};
+
+  private:
+	std::vector<char32_t> bounds; // shard i holds the keys whose first codepoint is in [bounds[i - 1], bounds[i])
+	std::vector<std::unique_ptr<Shard>> shards;
+
+  private:
+	// first codepoint of the normalized key, ascii keys skip the normalization
+	static char32_t FirstCodepoint(std::string_view key)
+	{
+		if (key.empty() || !una::is_valid_utf8(key))
+		{
+			return 0;
+		}
+		if ((unsigned char)key[0] < 0x80)
+		{
+			return Trie::NormalizeAscii(key[0]);
+		}
+		return Trie::Normalize(key)[0];
+	}
+
+	size_t ShardOf(std::string_view key) const
+	{
+		return std::upper_bound(bounds.begin(), bounds.end(), FirstCodepoint(key)) - bounds.begin();
+	}
+
+	void MakeShards()
+	{
+		shards.clear();
+		for (size_t i = 0; i <= bounds.size(); ++i)
+		{
+			shards.push_back(std::make_unique<Shard>());
+		}
+	}
+
+	template <typename Visit> auto Read(size_t shard, Visit visit) const
+	{
+		std::shared_lock<std::shared_mutex> lock(shards[shard]->lock);
+		return visit(shards[shard]->trie);
+	}
+
+	template <typename Change> auto Write(size_t shard, Change change)
+	{
+		std::unique_lock<std::shared_mutex> lock(shards[shard]->lock);
+		return change(shards[shard]->trie);
+	}
+
+  public:
+	// split the lowercase ascii letters evenly, a fair guess for latin text when no sample of keys is at hand
+	explicit ShardedRBTrie(unsigned count = std::thread::hardware_concurrency())
+	{
+		count = std::clamp(count, 1u, 26u);
+		for (unsigned i = 1; i < count; ++i)
+		{
+			bounds.push_back(U'a' + 26 * i / count);
+		}
+		MakeShards();
+	}
+	// split at the quantiles of the first codepoints of a sample of keys, so shards get about as many keys each
+	// keys sharing a first codepoint always share a shard, so there may be fewer shards than asked for
+	template <typename Range> ShardedRBTrie(unsigned count, const Range &sample)
+	{
+		count = std::max(count, 1u);
+		std::map<char32_t, size_t> firsts;
+		size_t total = 0;
+		for (const auto &key : sample)
+		{
+			std::string_view view(key);
+			if (!view.empty() && una::is_valid_utf8(view))
+			{
+				firsts[FirstCodepoint(view)]++;
+				total++;
+			}
+		}
+		size_t seen = 0;
+		for (const auto &[c, n] : firsts)
+		{
+			if (seen > 0 && bounds.size() + 1 < count && seen * count >= total * (bounds.size() + 1))
+			{
+				bounds.push_back(c);
+			}
+			seen += n;
+		}
+		MakeShards();
+	}
+	ShardedRBTrie(const ShardedRBTrie &) = delete;
+	ShardedRBTrie &operator=(const ShardedRBTrie &) = delete;
+
+	size_t ShardCount() const
+	{
+		return shards.size();
+	}
+
+	void Clear()
+	{
+		for (size_t i = 0; i < shards.size(); ++i)
+		{
+			Write(i, [](Trie &trie) { trie.Clear(); });
+		}
+	}
+	// return the number of node in all shards
+	long long Count() const
+	{
+		long long count = 0;
+		for (size_t i = 0; i < shards.size(); ++i)
+		{
+			count += Read(i, [](const Trie &trie) { return trie.Count(); });
+		}
+		return count;
+	}
+	// return the number of string in all shards
+	long long Size() const
+	{
+		long long size = 0;
+		for (size_t i = 0; i < shards.size(); ++i)
+		{
+			size += Read(i, [](const Trie &trie) { return trie.Size(); });
+		}
+		return size;
+	}
+
+	// replace the content with a range of key/value pairs, see RBTrie::BuildFromSorted
+	// the keys are split by shard and up to threads shards are built at the same time
+	// entries must stay alive and unchanged during the call
+	template <typename Range> void BuildFromSorted(const Range &entries, unsigned threads = 1)
+	{
+		std::vector<std::vector<std::pair<std::string_view, std::string_view>>> parts(shards.size());
+		for (const auto &[key, value] : entries)
+		{
+			parts[ShardOf(key)].emplace_back(key, value);
+		}
+		std::atomic<size_t> next = 0;
+		auto work = [&]() {
+			for (size_t i = next++; i < shards.size(); i = next++)
+			{
+				Write(i, [&](Trie &trie) { trie.BuildFromSorted(parts[i]); });
+			}
+		};
+		std::vector<std::thread> workers;
+		for (unsigned t = 1; t < std::min<size_t>(std::max(threads, 1u), shards.size()); ++t)
+		{
+			workers.emplace_back(work);
+		}
+		work();
+		for (auto &worker : workers)
+		{
+			worker.join();
+		}
+	}
+	// see RBTrie::Insert, only the shard of key is locked
+	void Insert(const std::string &key, const std::string &value, uint32_t weight = 0)
+	{
+		Write(ShardOf(key), [&](Trie &trie) { trie.Insert(key, value, weight); });
+	}
+	void Remove(const std::string &key)
+	{
+		Write(ShardOf(key), [&](Trie &trie) { trie.Remove(key); });
+	}
+
+	// return a copy of the value of key, or nothing if key is not in the tree
+	std::optional<std::string> Search(std::string_view key) const
+	{
+		return Read(ShardOf(key), [&](const Trie &trie) -> std::optional<std::string> {
+			const std::string *value = trie.Search(key);
+			return value != nullptr ? std::optional<std::string>(*value) : std::nullopt;
+		});
+	}
+	// completions share the first codepoint of the prefix, so they all live in one shard
+	std::vector<std::string> PrefixSearch(std::string_view key, size_t limit = SIZE_MAX, size_t offset = 0) const
+	{
+		return Read(ShardOf(key), [&](const Trie &trie) { return trie.PrefixSearch(key, limit, offset); });
+	}
+	std::vector<std::string> TopK(std::string_view prefix, size_t k) const
+	{
+		return Read(ShardOf(prefix), [&](const Trie &trie) { return trie.TopK(prefix, k); });
+	}
+	// get the k-th string over all shards, counting from 1
+	std::string GetKthWord(long long k) const
+	{
+		for (size_t i = 0; i < shards.size() && k >= 1; ++i)
+		{
+			std::optional<std::string> word = Read(i, [&](const Trie &trie) -> std::optional<std::string> {
+				if (k <= trie.Size())
+				{
+					return trie.GetKthWord(k);
+				}
+				k -= trie.Size();
+				return std::nullopt;
+			});
+			if (word)
+			{
+				return *word;
+			}
+		}
+		return {};
+	}
+	// get the position of key over all shards, counting from 1, or 0 if key is not in the tree
+	long long Rank(std::string_view key) const
+	{
+		size_t shard = ShardOf(key);
+		long long rank = Read(shard, [&](const Trie &trie) { return trie.Rank(key); });
+		if (rank == 0)
+		{
+			return 0;
+		}
+		for (size_t i = 0; i < shard; ++i)
+		{
+			rank += Read(i, [](const Trie &trie) { return trie.Size(); });
+		}
+		return rank;
+	}
+};
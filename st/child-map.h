@@ -0,0 +1,209 @@
+#pragma once
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+/* Child edges of a suffix tree node, keyed by the first character of the edge.
+ * The representation adapts to the fan-out:
+ * - up to SMALL children sit inline in the node, so most steps of a walk touch a single cache line,
+ * - more children go to a sorted array on the heap,
+ * - from DENSE children on (in practice the root), characters below TABLE get a direct lookup table.
+ * Children are never removed, which keeps the representation a function of the size alone.
+ * Child index 0 is the root, which is never a child, so Find returns 0 for a missing edge.
+ */
+class ChildMap
+{
+  private:
+	static const uint32_t SMALL = 4;
+	static const uint32_t DENSE = 64;
+	static const char32_t TABLE = 256;
+
+	struct Entry
+	{
+		char32_t key;
+		int child;
+
+		friend bool operator<(const Entry &lhs, const Entry &rhs)
+		{
+			return lhs.key < rhs.key;
+		}
+	};
+
+	struct Wide
+	{
+		std::vector<Entry> entries; // sorted, only keys not covered by table
+		std::vector<int> table;		// empty until the map becomes dense
+	};
+
+  private:
+	uint32_t count;
+	union {
+		struct
+		{
+			char32_t keys[SMALL];
+			int kids[SMALL];
+		} small;
+		Wide *wide;
+	};
+
+  private:
+	bool IsSmall() const
+	{
+		return count <= SMALL;
+	}
+	void MakeWide()
+	{
+		Wide *w = new Wide;
+		w->entries.reserve(SMALL * 2);
+		for (uint32_t i = 0; i < count; ++i)
+		{
+			w->entries.push_back({small.keys[i], small.kids[i]});
+		}
+		wide = w;
+	}
+	void MakeDense()
+	{
+		wide->table.assign(TABLE, 0);
+		auto split = std::lower_bound(wide->entries.begin(), wide->entries.end(), Entry{TABLE, 0});
+		for (auto entry = wide->entries.begin(); entry != split; ++entry)
+		{
+			wide->table[entry->key] = entry->child;
+		}
+		wide->entries.erase(wide->entries.begin(), split);
+	}
+
+  public:
+	ChildMap() : count(0){};
+	ChildMap(const ChildMap &other) : count(other.count)
+	{
+		if (IsSmall())
+		{
+			small = other.small;
+		}
+		else
+		{
+			wide = new Wide(*other.wide);
+		}
+	}
+	ChildMap(ChildMap &&other) noexcept : count(other.count)
+	{
+		if (IsSmall())
+		{
+			small = other.small;
+		}
+		else
+		{
+			wide = other.wide;
+			other.count = 0;
+		}
+	}
+	ChildMap &operator=(ChildMap other) noexcept
+	{
+		std::swap(count, other.count);
+		std::swap(small, other.small); // the union is trivially copyable, swapping its largest member swaps all
+		return *this;
+	}
+	~ChildMap()
+	{
+		if (!IsSmall())
+		{
+			delete wide;
+		}
+	}
+	uint32_t Size() const
+	{
+		return count;
+	}
+	// return the child whose edge starts with c, or 0 if there is none
+	int Find(char32_t c) const
+	{
+		if (IsSmall())
+		{
+			for (uint32_t i = 0; i < count; ++i)
+			{
+				if (small.keys[i] == c)
+				{
+					return small.kids[i];
+				}
+			}
+			return 0;
+		}
+		if (c < TABLE && !wide->table.empty())
+		{
+			return wide->table[c];
+		}
+		auto entry = std::lower_bound(wide->entries.begin(), wide->entries.end(), Entry{c, 0});
+		return entry != wide->entries.end() && entry->key == c ? entry->child : 0;
+	}
+	// add the edge c -> child, or redirect it if it already exists
+	void Set(char32_t c, int child)
+	{
+		if (IsSmall())
+		{
+			uint32_t i = 0;
+			while (i < count && small.keys[i] < c)
+			{
+				i++;
+			}
+			if (i < count && small.keys[i] == c)
+			{
+				small.kids[i] = child;
+				return;
+			}
+			if (count < SMALL)
+			{
+				for (uint32_t j = count; j > i; --j)
+				{
+					small.keys[j] = small.keys[j - 1];
+					small.kids[j] = small.kids[j - 1];
+				}
+				small.keys[i] = c;
+				small.kids[i] = child;
+				count++;
+				return;
+			}
+			MakeWide();
+		}
+		if (c < TABLE && !wide->table.empty())
+		{
+			count += wide->table[c] == 0;
+			wide->table[c] = child;
+			return;
+		}
+		auto entry = std::lower_bound(wide->entries.begin(), wide->entries.end(), Entry{c, 0});
+		if (entry != wide->entries.end() && entry->key == c)
+		{
+			entry->child = child;
+			return;
+		}
+		wide->entries.insert(entry, Entry{c, child});
+		count++;
+		if (count == DENSE)
+		{
+			MakeDense();
+		}
+	}
+	// visit every edge in increasing order of its first character
+	template <typename Visit> void ForEach(Visit visit) const
+	{
+		if (IsSmall())
+		{
+			for (uint32_t i = 0; i < count; ++i)
+			{
+				visit(small.keys[i], small.kids[i]);
+			}
+			return;
+		}
+		for (char32_t c = 0; c < wide->table.size(); ++c)
+		{
+			if (wide->table[c] != 0)
+			{
+				visit(c, wide->table[c]);
+			}
+		}
+		for (const Entry &entry : wide->entries)
+		{
+			visit(entry.key, entry.child);
+		}
+	}
+};
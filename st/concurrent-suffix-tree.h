@@ -0,0 +1,95 @@
+#pragma once
+#include "left-right.h"
+#include "suffix_tree.h"
+#include <cstddef>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+/* Suffix tree shared by many readers and one writer at a time, the two copies are kept by LeftRight.
+ * Every change is applied to both copies, but nothing is ever copied and a reader never sees a half-built tree.
+ *
+ * Add only queues an entry, Publish applies the queued entries and rebuilds the document index of both copies, so a
+ * batch of entries costs one index build per copy. Entries become visible to Find after Publish returns.
+ */
+template <typename Tree = SuffixTreeRB> class ConcurrentSuffixTree
+{
+  public:
+	using KeyValue = typename Tree::KeyValue;
+
+  private:
+	LeftRight<Tree> trees;
+
+	std::mutex writer; // guards pending, LeftRight orders the writes to the copies
+	std::vector<std::pair<std::string, std::string>> pending;
+
+  private:
+	void Apply(Tree &tree, const std::vector<std::pair<std::string, std::string>> &entries)
+	{
+		for (const auto &entry : entries)
+		{
+			tree.Add(entry.first, entry.second);
+		}
+		tree.BuildIndex();
+	}
+
+  public:
+	ConcurrentSuffixTree()
+	{
+		trees.Write([](Tree &tree) { tree.BuildIndex(); });
+	}
+	ConcurrentSuffixTree(const ConcurrentSuffixTree &) = delete;
+	ConcurrentSuffixTree &operator=(const ConcurrentSuffixTree &) = delete;
+
+	// Run visit on the published tree and return its result, see LeftRight::Read.
+	template <typename Visit> auto Read(Visit visit) const
+	{
+		return trees.Read(visit);
+	}
+
+	std::vector<KeyValue> Find(std::string key) const
+	{
+		return Read([&](const Tree &tree) { return tree.Find(key); });
+	}
+
+	void Find(std::string key, std::vector<KeyValue> &keyValue) const
+	{
+		Read([&](const Tree &tree) { tree.Find(key, keyValue); });
+	}
+
+	bool Contain(const std::u32string_view &u32strv) const
+	{
+		return Read([&](const Tree &tree) { return tree.Contain(u32strv); });
+	}
+
+	size_t Count() const
+	{
+		return Read([](const Tree &tree) { return tree.Count(); });
+	}
+
+	size_t Size() const
+	{
+		return Read([](const Tree &tree) { return tree.Size(); });
+	}
+
+	// Queue an entry, it is not visible until the next Publish
+	void Add(std::string key, std::string value)
+	{
+		std::lock_guard<std::mutex> lock(writer);
+		pending.emplace_back(std::move(key), std::move(value));
+	}
+
+	// Apply the queued entries to both copies, readers keep running on one copy while the other is changed
+	void Publish()
+	{
+		std::lock_guard<std::mutex> lock(writer);
+		if (pending.empty())
+		{
+			return;
+		}
+		trees.Write([&](Tree &tree) { Apply(tree, pending); });
+		pending.clear();
+	}
+};
@@ -0,0 +1,382 @@
+#pragma once
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <limits>
+#include <string>
+#include <string_view>
+#include <uni_algo/all.h>
+#include <unordered_set>
+#include <vector>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <Windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+/* Flat on-disk layout of a suffix tree, meant to be memory-mapped and queried in place.
+ * The file is a header followed by 4-byte aligned sections, all in host byte order:
+ * - text: textSize char32_t,
+ * - nodes: nodeCount Node,
+ * - edge offsets: nodeCount + 1 uint32_t, the children of node i are edges[offsets[i], offsets[i + 1]),
+ * - edges: edgeCount Edge, sorted by character within a node,
+ * - satellites: satelliteCount Satellite,
+ * - data offsets: satelliteCount + 1 uint32_t into the data section,
+ * - data: dataBytes bytes of satellite values.
+ */
+namespace flat
+{
+const uint32_t MAGIC = 0x46525453; // "STRF"
+const uint32_t VERSION = 1;
+const uint32_t ENDIAN = 0x01020304;
+
+struct Header
+{
+	uint32_t magic;
+	uint32_t version;
+	uint32_t endian;
+	uint32_t textSize;
+	uint32_t nodeCount;
+	uint32_t edgeCount;
+	uint32_t satelliteCount;
+	uint32_t dataBytes;
+};
+
+struct Node
+{
+	int32_t start;
+	int32_t end;
+	int32_t link; // minus the satellite index for a leaf
+};
+
+struct Edge
+{
+	char32_t c;
+	int32_t child;
+};
+
+struct Satellite
+{
+	int32_t keyLen;
+	int32_t keyPos;
+};
+
+// return the size in bytes of the file described by the header
+inline uint64_t FileSize(const Header &header)
+{
+	uint64_t words = (uint64_t)header.textSize + header.nodeCount * 3ull + header.nodeCount + 1 +
+					 header.edgeCount * 2ull + header.satelliteCount * 2ull + header.satelliteCount + 1;
+	return sizeof(Header) + words * sizeof(uint32_t) + header.dataBytes;
+}
+} // namespace flat
+
+/* Read-only suffix tree over a file written by SerializeFlat.
+ * Opening maps the file and checks every index in it once, nothing is copied or rebuilt, and processes mapping the same
+ * file share its pages. Queries then trust the file, so a truncated or corrupted one is rejected by Open rather than
+ * read out of bounds.
+ */
+class MappedSuffixTree
+{
+  public:
+	class KeyValue
+	{
+	  public:
+		std::string key;
+		std::string value;
+	};
+
+  private:
+	const char *base;
+	size_t size;
+#ifdef _WIN32
+	HANDLE file;
+	HANDLE mapping;
+#endif
+
+	const flat::Header *header;
+	const char32_t *text;
+	const flat::Node *nodes;
+	const uint32_t *edgeOffsets;
+	const flat::Edge *edges;
+	const flat::Satellite *satellites;
+	const uint32_t *dataOffsets;
+	const char *data;
+
+  private:
+	int EdgeLength(int node) const
+	{
+		return std::min<int64_t>(nodes[node].end, header->textSize) - nodes[node].start;
+	}
+
+	int Child(int node, char32_t c) const
+	{
+		const flat::Edge *first = edges + edgeOffsets[node];
+		const flat::Edge *last = edges + edgeOffsets[node + 1];
+		const flat::Edge *edge =
+			std::lower_bound(first, last, c, [](const flat::Edge &edge, char32_t c) { return edge.c < c; });
+		return edge != last && edge->c == c ? edge->child : 0;
+	}
+
+	// walk down from the root along the key, return the node below the end of the key or -1
+	int Walk(std::u32string_view key) const
+	{
+		int curNode = 0, curLength = 0;
+		for (int i = 0; i < key.size(); ++i)
+		{
+			if (curLength == EdgeLength(curNode))
+			{
+				int child = Child(curNode, key[i]);
+				if (child == 0)
+				{
+					return -1;
+				}
+				curNode = child;
+				curLength = 1;
+			}
+			else if (key[i] == text[nodes[curNode].start + curLength])
+			{
+				curLength++;
+			}
+			else
+			{
+				return -1;
+			}
+		}
+		return curNode;
+	}
+
+	// check every index Find and Contain follow, and that the edges form a tree below the root
+	bool Check() const
+	{
+		int64_t textSize = header->textSize;
+		// the root has an empty edge
+		if (edgeOffsets[0] != 0 || edgeOffsets[header->nodeCount] != header->edgeCount ||
+			nodes[0].start != nodes[0].end || nodes[0].start < -1 || nodes[0].start > textSize)
+		{
+			return false;
+		}
+		std::vector<bool> hasParent(header->nodeCount, false);
+		hasParent[0] = true; // the root is never a child
+		for (uint32_t i = 0; i < header->nodeCount; ++i)
+		{
+			const flat::Node &node = nodes[i];
+			bool leaf = node.end == std::numeric_limits<int>::max();
+			if (i > 0 && (node.start < 0 || node.start > std::min<int64_t>(node.end, textSize)))
+			{
+				return false;
+			}
+			if (leaf && (node.link > 0 || -(int64_t)node.link >= header->satelliteCount))
+			{
+				return false;
+			}
+			if (edgeOffsets[i] > edgeOffsets[i + 1])
+			{
+				return false;
+			}
+			for (uint32_t e = edgeOffsets[i]; e < edgeOffsets[i + 1]; ++e)
+			{
+				int32_t child = edges[e].child;
+				if (child <= 0 || child >= (int64_t)header->nodeCount || hasParent[child] ||
+					(e > edgeOffsets[i] && edges[e - 1].c >= edges[e].c))
+				{
+					return false;
+				}
+				hasParent[child] = true;
+			}
+		}
+		if (dataOffsets[0] != 0 || dataOffsets[header->satelliteCount] > header->dataBytes)
+		{
+			return false;
+		}
+		for (uint32_t i = 0; i < header->satelliteCount; ++i)
+		{
+			const flat::Satellite &sat = satellites[i];
+			if (sat.keyLen < 0 || sat.keyPos < 0 || sat.keyPos > textSize - sat.keyLen ||
+				dataOffsets[i] > dataOffsets[i + 1])
+			{
+				return false;
+			}
+		}
+		return true;
+	}
+
+	void Unmap()
+	{
+		if (base == nullptr)
+		{
+			return;
+		}
+#ifdef _WIN32
+		UnmapViewOfFile(base);
+		CloseHandle(mapping);
+		CloseHandle(file);
+#else
+		munmap((void *)base, size);
+#endif
+		base = nullptr;
+		size = 0;
+	}
+
+	bool Map(const std::filesystem::path &path)
+	{
+#ifdef _WIN32
+		file = CreateFileW(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL,
+						   nullptr);
+		if (file == INVALID_HANDLE_VALUE)
+		{
+			return false;
+		}
+		LARGE_INTEGER fileSize;
+		if (!GetFileSizeEx(file, &fileSize) || fileSize.QuadPart < (LONGLONG)sizeof(flat::Header))
+		{
+			CloseHandle(file);
+			return false;
+		}
+		mapping = CreateFileMappingW(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+		if (mapping == nullptr)
+		{
+			CloseHandle(file);
+			return false;
+		}
+		base = (const char *)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+		if (base == nullptr)
+		{
+			CloseHandle(mapping);
+			CloseHandle(file);
+			return false;
+		}
+		size = fileSize.QuadPart;
+#else
+		int fd = open(path.c_str(), O_RDONLY);
+		if (fd < 0)
+		{
+			return false;
+		}
+		struct stat st;
+		if (fstat(fd, &st) != 0 || st.st_size < (off_t)sizeof(flat::Header))
+		{
+			close(fd);
+			return false;
+		}
+		void *addr = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+		close(fd);
+		if (addr == MAP_FAILED)
+		{
+			return false;
+		}
+		base = (const char *)addr;
+		size = st.st_size;
+#endif
+		return true;
+	}
+
+  public:
+	MappedSuffixTree() : base(nullptr), size(0), header(nullptr){};
+	MappedSuffixTree(const MappedSuffixTree &) = delete;
+	MappedSuffixTree &operator=(const MappedSuffixTree &) = delete;
+	~MappedSuffixTree()
+	{
+		Unmap();
+	}
+
+	// Map the file written by SerializeFlat, the tree stays usable until the next Open or destruction
+	bool Open(std::filesystem::path directory, std::string filename)
+	{
+		Unmap();
+		if (!Map(directory / (const char8_t *)(filename + ".flat").c_str()))
+		{
+			return false;
+		}
+		header = (const flat::Header *)base;
+		if (header->magic != flat::MAGIC || header->version != flat::VERSION || header->endian != flat::ENDIAN ||
+			header->nodeCount == 0 || flat::FileSize(*header) != size)
+		{
+			Unmap();
+			return false;
+		}
+		text = (const char32_t *)(header + 1);
+		nodes = (const flat::Node *)(text + header->textSize);
+		edgeOffsets = (const uint32_t *)(nodes + header->nodeCount);
+		edges = (const flat::Edge *)(edgeOffsets + header->nodeCount + 1);
+		satellites = (const flat::Satellite *)(edges + header->edgeCount);
+		dataOffsets = (const uint32_t *)(satellites + header->satelliteCount);
+		data = (const char *)(dataOffsets + header->satelliteCount + 1);
+		if (!Check())
+		{
+			Unmap();
+			return false;
+		}
+		return true;
+	}
+
+	bool IsOpen() const
+	{
+		return base != nullptr;
+	}
+
+	size_t Count() const
+	{
+		return IsOpen() ? header->textSize : 0;
+	}
+
+	size_t Size() const
+	{
+		return IsOpen() ? header->nodeCount : 0;
+	}
+
+	bool Contain(const std::u32string_view &u32strv) const
+	{
+		return IsOpen() && Walk(u32strv) >= 0;
+	}
+
+	std::vector<KeyValue> Find(std::string key) const
+	{
+		if (!IsOpen() || key.empty() || !una::is_valid_utf8(key))
+		{
+			return {};
+		}
+		int node = Walk(una::utf8to32u(una::norm::to_nfd_utf8(key)));
+		if (node < 0)
+		{
+			return {};
+		}
+
+		std::vector<KeyValue> keyValue;
+		std::unordered_set<int> collected;
+		std::vector<int> stack{node};
+		while (!stack.empty())
+		{
+			int curNode = stack.back();
+			stack.pop_back();
+			if (nodes[curNode].end == std::numeric_limits<int>::max())
+			{
+				int i = -nodes[curNode].link;
+				if (collected.insert(i).second)
+				{
+					const flat::Satellite &sat = satellites[i];
+					keyValue.push_back(
+						{una::norm::to_nfc_utf8(una::utf32to8(std::u32string_view(text + sat.keyPos, sat.keyLen))),
+						 std::string(data + dataOffsets[i], dataOffsets[i + 1] - dataOffsets[i])});
+				}
+				continue;
+			}
+			// push in reverse so children are visited in increasing order, as SuffixTreeRB::Find does
+			for (uint32_t e = edgeOffsets[curNode + 1]; e > edgeOffsets[curNode]; --e)
+			{
+				stack.push_back(edges[e - 1].child);
+			}
+		}
+		return keyValue;
+	}
+};
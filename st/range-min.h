@@ -0,0 +1,77 @@
+#pragma once
+#include <algorithm>
+#include <bit>
+#include <utility>
+#include <vector>
+
+/* Position of the minimum of a static array over any range, in constant time.
+ * The array is cut into blocks of BLOCK values, a sparse table answers the query over whole blocks and the at most two
+ * partial blocks at the ends are scanned. The table holds (n / BLOCK) log n positions, a small fraction of the array.
+ */
+class RangeMin
+{
+  private:
+	static const int BLOCK = 16;
+
+	std::vector<int> values;
+	std::vector<std::vector<int>> table; // table[k][b]: position of the minimum over blocks [b, b + 2^k)
+
+  private:
+	int Better(int a, int b) const
+	{
+		return values[b] < values[a] ? b : a;
+	}
+	int Scan(int lower, int upper) const
+	{
+		int best = lower;
+		for (int i = lower + 1; i < upper; ++i)
+		{
+			best = Better(best, i);
+		}
+		return best;
+	}
+
+  public:
+	RangeMin() = default;
+	RangeMin(std::vector<int> array) : values(std::move(array))
+	{
+		int blocks = (values.size() + BLOCK - 1) / BLOCK;
+		table.emplace_back(blocks);
+		for (int b = 0; b < blocks; ++b)
+		{
+			table[0][b] = Scan(b * BLOCK, std::min<int>((b + 1) * BLOCK, values.size()));
+		}
+		for (int k = 1; (1 << k) <= blocks; ++k)
+		{
+			const std::vector<int> &prev = table[k - 1];
+			std::vector<int> cur(blocks - (1 << k) + 1);
+			for (int b = 0; b < cur.size(); ++b)
+			{
+				cur[b] = Better(prev[b], prev[b + (1 << (k - 1))]);
+			}
+			table.push_back(std::move(cur));
+		}
+	}
+
+	int Value(int i) const
+	{
+		return values[i];
+	}
+
+	// position of the minimum over [lower, upper), which must not be empty
+	int ArgMin(int lower, int upper) const
+	{
+		int first = lower / BLOCK, last = (upper - 1) / BLOCK;
+		if (first == last)
+		{
+			return Scan(lower, upper);
+		}
+		int best = Better(Scan(lower, (first + 1) * BLOCK), Scan(last * BLOCK, upper));
+		if (first + 1 < last)
+		{
+			int k = std::bit_width((unsigned)(last - first - 1)) - 1;
+			best = Better(best, Better(table[k][first + 1], table[k][last - (1 << k)]));
+		}
+		return best;
+	}
+};
@@ -63,6 +63,7 @@ template <typename Key, typename Value> class RBTree
   private:
 	Node *root;
 	Node *nil; // sentinel, stand-in for root->parent and leaves
+	int count; // number of keys, kept up to date by Insert and Remove
 
   private:
 	// assume x->right is not nil
@@ -293,16 +294,17 @@ template <typename Key, typename Value> class RBTree
 	}
 
   public:
-	RBTree() : nil(new Node{Node::BLACK})
+	RBTree() : nil(new Node{Node::BLACK}), count(0)
 	{
 		nil->parent = nil->left = nil->right = nil;
 		root = nil;
 	}
-	RBTree(RBTree &&other) : nil(other.nil), root(other.root)
+	RBTree(RBTree &&other) : root(other.root), nil(other.nil), count(other.count)
 	{
 		other.nil = new Node{Node::BLACK, Key(), Value(), nullptr, nullptr, nullptr};
 		other.nil->left = other.nil->right = other.nil->parent = other.nil;
 		other.root = other.nil;
+		other.count = 0;
 	}
 	~RBTree()
 	{
@@ -368,6 +370,7 @@ template <typename Key, typename Value> class RBTree
 		{
 			y->right = z;
 		}
+		count++;
 		InsertFixup(z);
 	}
 	void Remove(Key key)
@@ -392,7 +395,7 @@ template <typename Key, typename Value> class RBTree
 		}
 		// keep the color, if the deletee node is black then there will be rule violations to fix
 		Node *y = z;
-		Node::template Color yOriginalColor = y->color;
+		typename Node::Color yOriginalColor = y->color;
 		// the site of rule violations if there are any
 		Node *x;
 		if (z->left == nil)
@@ -432,6 +435,7 @@ template <typename Key, typename Value> class RBTree
 		}
 		// finally delete the deletee
 		delete z;
+		count--;
 		// fix any problems that arise
 		if (yOriginalColor == Node::BLACK)
 		{
@@ -441,14 +445,7 @@ template <typename Key, typename Value> class RBTree
 	}
 	int Size() const
 	{
-		int size = 0;
-		Node *cur = Minimum(root);
-		while (cur != nil)
-		{
-			size++;
-			cur = Successor(cur);
-		}
-		return size;
+		return count;
 	}
 	Iterator Begin() const
 	{
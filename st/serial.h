@@ -0,0 +1,182 @@
+#pragma once
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <limits>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+/* Buffered binary files for the suffix tree serializers.
+ * A Writer collects whole arrays into one buffer, which Save writes after a header in a single call. The header holds
+ * a magic number, the format version, an endianness marker, the kind of file, the payload size and a checksum of the
+ * payload. Load reads the file in a single call and rejects it when any header field does not match, so a truncated,
+ * corrupted or foreign file is reported instead of being misparsed. Reads past the payload fail as well.
+ */
+namespace serial
+{
+const uint32_t MAGIC = 0x53525453; // "STRS"
+const uint32_t VERSION = 1;
+const uint32_t ENDIAN = 0x01020304;
+
+// kinds of file
+const uint32_t TEXT = 0x54584554; // "TEXT"
+const uint32_t TREE = 0x45455254; // "TREE"
+const uint32_t SATE = 0x45544153; // "SATE"
+
+struct Header
+{
+	uint32_t magic;
+	uint32_t version;
+	uint32_t endian;
+	uint32_t kind;
+	uint64_t bytes;
+	uint64_t checksum;
+};
+
+// fast non-cryptographic checksum, a word at a time
+inline uint64_t Checksum(const char *data, size_t size)
+{
+	uint64_t hash = 0x9E3779B97F4A7C15ull ^ size;
+	size_t i = 0;
+	for (; i + sizeof(uint64_t) <= size; i += sizeof(uint64_t))
+	{
+		uint64_t word;
+		std::memcpy(&word, data + i, sizeof(word));
+		hash = (hash ^ word) * 0xFF51AFD7ED558CCDull;
+		hash ^= hash >> 32;
+	}
+	for (; i < size; ++i)
+	{
+		hash = (hash ^ (unsigned char)data[i]) * 0x100000001B3ull;
+	}
+	hash ^= hash >> 33;
+	hash *= 0xC4CEB9FE1A85EC53ull;
+	hash ^= hash >> 33;
+	return hash;
+}
+
+class Writer
+{
+  private:
+	std::string buffer;
+
+  public:
+	template <typename T> void Put(const T &value)
+	{
+		static_assert(std::is_trivially_copyable_v<T>);
+		buffer.append((const char *)&value, sizeof(T));
+	}
+	template <typename T> void Put(const T *data, size_t count)
+	{
+		static_assert(std::is_trivially_copyable_v<T>);
+		buffer.append((const char *)data, count * sizeof(T));
+	}
+	template <typename T> void Put(const std::vector<T> &data)
+	{
+		Put(data.data(), data.size());
+	}
+	bool Save(const std::filesystem::path &path, uint32_t kind) const
+	{
+		std::ofstream fileOut(path, std::ios::out | std::ios::binary);
+		if (!fileOut)
+		{
+			return false;
+		}
+		Header header{MAGIC, VERSION, ENDIAN, kind, buffer.size(), Checksum(buffer.data(), buffer.size())};
+		fileOut.write((const char *)&header, sizeof(header));
+		fileOut.write(buffer.data(), buffer.size());
+		return (bool)fileOut;
+	}
+};
+
+class Reader
+{
+  private:
+	std::string buffer;
+	size_t pos = 0;
+
+  public:
+	bool Load(const std::filesystem::path &path, uint32_t kind)
+	{
+		std::ifstream fileIn(path, std::ios::in | std::ios::binary);
+		Header header;
+		if (!fileIn || !fileIn.read((char *)&header, sizeof(header)))
+		{
+			return false;
+		}
+		std::error_code error;
+		uint64_t fileSize = std::filesystem::file_size(path, error);
+		if (error || header.magic != MAGIC || header.version != VERSION || header.endian != ENDIAN ||
+			header.kind != kind || header.bytes != fileSize - sizeof(header))
+		{
+			return false;
+		}
+		buffer.resize(header.bytes);
+		pos = 0;
+		return fileIn.read(buffer.data(), buffer.size()) && Checksum(buffer.data(), buffer.size()) == header.checksum;
+	}
+	template <typename T> bool Get(T &value)
+	{
+		return Get(&value, 1);
+	}
+	template <typename T> bool Get(T *data, size_t count)
+	{
+		static_assert(std::is_trivially_copyable_v<T>);
+		if (count > (buffer.size() - pos) / sizeof(T))
+		{
+			return false;
+		}
+		std::memcpy((void *)data, buffer.data() + pos, count * sizeof(T));
+		pos += count * sizeof(T);
+		return true;
+	}
+	template <typename T> bool Get(std::vector<T> &data, size_t count)
+	{
+		if (count > (buffer.size() - pos) / sizeof(T))
+		{
+			return false;
+		}
+		data.resize(count);
+		return Get(data.data(), count);
+	}
+	// whether the whole payload has been consumed
+	bool Done() const
+	{
+		return pos == buffer.size();
+	}
+};
+
+/* Check the nodes and the building state of a loaded suffix tree against the sizes of its text and satellites.
+ * state is root, needSL, remainder, activeNode, activeEdge, activeLength. A leaf ends at int max and links to minus its
+ * satellite, other nodes link to a node or 0 and have an edge within the text, the root's is empty at -1.
+ */
+inline bool CheckTree(int textSize, int satCnt, const int state[6], const std::vector<int> &starts,
+					  const std::vector<int> &ends, const std::vector<int> &links)
+{
+	const int oo = std::numeric_limits<int>::max();
+	int treeSize = starts.size();
+	auto isNode = [treeSize](int node) { return node >= 0 && node < treeSize; };
+	for (int i = 0; i < treeSize; ++i)
+	{
+		if (ends[i] == oo)
+		{
+			if (starts[i] < 0 || starts[i] > textSize || links[i] > 0 || -(int64_t)links[i] >= satCnt)
+			{
+				return false;
+			}
+		}
+		else if (starts[i] < (i == state[0] ? -1 : 0) || starts[i] > ends[i] || ends[i] > textSize ||
+				 !isNode(links[i]))
+		{
+			return false;
+		}
+	}
+	int root = state[0], needSL = state[1], remainder = state[2];
+	int activeNode = state[3], activeEdge = state[4], activeLength = state[5];
+	return isNode(root) && ends[root] != oo && starts[root] == -1 && ends[root] == -1 && isNode(needSL) &&
+		   ends[needSL] != oo && remainder >= 0 && remainder <= textSize && isNode(activeNode) &&
+		   ends[activeNode] != oo && activeEdge >= 0 && activeLength >= 0 && activeEdge <= textSize - activeLength;
+}
+} // namespace serial
@@ -1,7 +1,9 @@
 #pragma once
 
-#include "red_black_tree.h"
 #include "uni_algo/all.h"
+#include <algorithm>
+#include <bit>
+#include <cstdint>
 #include <iostream>
 #include <string>
 #include <vector>
@@ -11,176 +13,316 @@ namespace old
 class SuffixArray
 {
   private:
-	struct Rank
+	std::u32string str;
+	std::vector<int> sa;
+	std::vector<int> lcp;
+	std::vector<int> cld;
+	std::vector<std::string> values;
+	// bit p is set when str[p] is the separator ending a key, keyRanks[w] counts the bits set before word w,
+	// so the key owning position p is the number of separators before it
+	std::vector<uint64_t> separators;
+	std::vector<int> keyRanks;
+	std::vector<bool> collected; // keys already reported by the running Find, cleared before it returns
+
+  private:
+	// SA-IS: suffix array of s by induced sorting in O(n), s[n - 1] must be 0 and the only 0, every s[i] < k
+	static void InducedSort(const std::vector<int> &s, int k, std::vector<int> &sa)
 	{
-		int leftRank;
-		int rightRank;
-		int index;
+		int n = s.size();
+		sa.assign(n, -1);
+		if (n == 1)
+		{
+			sa[0] = 0;
+			return;
+		}
 
-		friend bool operator<(const Rank &lhs, const Rank &rhs)
+		// a suffix is S-type if it is smaller than the next one, L-type otherwise
+		std::vector<bool> stype(n);
+		stype[n - 1] = true;
+		for (int i = n - 2; i >= 0; --i)
 		{
-			return lhs.leftRank < rhs.leftRank || lhs.leftRank == rhs.leftRank && lhs.rightRank < rhs.rightRank;
+			stype[i] = s[i] < s[i + 1] || (s[i] == s[i + 1] && stype[i + 1]);
 		}
-	};
+		auto isLMS = [&stype](int i) { return i > 0 && stype[i] && !stype[i - 1]; };
 
-  private:
-	std::u32string str;
-	std::vector<int> sa;
-	RBTree<int, std::string> sate;
+		// bucket c of the suffix array spans [heads[c], heads[c + 1])
+		std::vector<int> heads(k + 1, 0);
+		for (int c : s)
+		{
+			heads[c + 1]++;
+		}
+		for (int c = 0; c < k; ++c)
+		{
+			heads[c + 1] += heads[c];
+		}
+		std::vector<int> next(k);
+		auto induce = [&](const std::vector<int> &lms) {
+			std::fill(sa.begin(), sa.end(), -1);
+			std::copy(heads.begin() + 1, heads.end(), next.begin());
+			for (int i = lms.size() - 1; i >= 0; --i)
+			{
+				sa[--next[s[lms[i]]]] = lms[i];
+			}
+			std::copy(heads.begin(), heads.end() - 1, next.begin());
+			for (int i = 0; i < n; ++i)
+			{
+				int j = sa[i] - 1;
+				if (j >= 0 && !stype[j])
+				{
+					sa[next[s[j]]++] = j;
+				}
+			}
+			std::copy(heads.begin() + 1, heads.end(), next.begin());
+			for (int i = n - 1; i >= 0; --i)
+			{
+				int j = sa[i] - 1;
+				if (j >= 0 && stype[j])
+				{
+					sa[--next[s[j]]] = j;
+				}
+			}
+		};
 
-  private:
-	void MakeRanks(std::vector<Rank> &substrRank, std::vector<int> &rank)
-	{
-		int r = 1;
-		rank[substrRank[0].index] = r;
-		for (int i = 1; i < str.size(); ++i)
+		// sort the LMS substrings by inducing from the LMS positions in text order
+		std::vector<int> lms;
+		for (int i = 1; i < n; ++i)
 		{
-			if (substrRank[i].leftRank != substrRank[i - 1].leftRank ||
-				substrRank[i].rightRank != substrRank[i - 1].rightRank)
+			if (isLMS(i))
 			{
-				r = r + 1;
+				lms.push_back(i);
 			}
-			rank[substrRank[i].index] = r;
 		}
-	}
-	void SortLeft(std::vector<Rank> &substrRank, int b)
-	{
-		int max = 0;
-		for (const Rank &elem : substrRank)
+		induce(lms);
+
+		// name them, equal substrings get equal names; LMS positions are at least 2 apart, so i / 2 is a unique slot
+		std::vector<int> names(n / 2 + 1, -1);
+		int name = 0, prev = -1;
+		for (int i = 0; i < n; ++i)
 		{
-			if (max < elem.leftRank)
+			int cur = sa[i];
+			if (!isLMS(cur))
 			{
-				max = elem.leftRank;
+				continue;
+			}
+			bool same = prev >= 0;
+			for (int d = 0; same; ++d)
+			{
+				if (s[cur + d] != s[prev + d] || stype[cur + d] != stype[prev + d])
+				{
+					same = false;
+				}
+				else if (d > 0 && (isLMS(cur + d) || isLMS(prev + d)))
+				{
+					same = isLMS(cur + d) && isLMS(prev + d);
+					break;
+				}
 			}
+			name += !same;
+			names[cur / 2] = name - 1;
+			prev = cur;
 		}
-		std::function<void(int)> countSort = [&substrRank, &b](int exp) {
-			std::vector<Rank> output(substrRank.size());
-			std::vector<int> count(b, 0);
-			for (int i = 0; i < substrRank.size(); ++i)
+
+		// order the LMS suffixes, through the suffix array of the reduced string if some names repeat
+		std::vector<int> reduced(lms.size());
+		for (int i = 0; i < lms.size(); ++i)
+		{
+			reduced[i] = names[lms[i] / 2];
+		}
+		std::vector<int>().swap(names);
+		std::vector<int> reducedSA;
+		if (name < lms.size())
+		{
+			InducedSort(reduced, name, reducedSA);
+		}
+		else
+		{
+			reducedSA.resize(lms.size());
+			for (int i = 0; i < lms.size(); ++i)
 			{
-				count[(substrRank[i].leftRank / exp) % b]++;
+				reducedSA[reduced[i]] = i;
 			}
-			for (int i = 1; i < count.size(); ++i)
+		}
+		for (int i = 0; i < lms.size(); ++i)
+		{
+			reducedSA[i] = lms[reducedSA[i]];
+		}
+		induce(reducedSA);
+	}
+	// Kasai: lcp[i] is the longest common prefix of the suffixes sa[i - 1] and sa[i], lcp[0] = lcp[n] = -1
+	void BuildLcp()
+	{
+		int n = sa.size();
+		std::vector<int> rank(n);
+		for (int i = 0; i < n; ++i)
+		{
+			rank[sa[i]] = i;
+		}
+		lcp.assign(n + 1, -1);
+		for (int i = 0, h = 0; i < n; ++i)
+		{
+			if (rank[i] == 0)
 			{
-				count[i] += count[i - 1];
+				h = 0;
+				continue;
 			}
-			for (int i = substrRank.size() - 1; i >= 0; --i)
+			int j = sa[rank[i] - 1];
+			while (i + h < n && j + h < n && str[i + h] == str[j + h])
 			{
-				output[count[(substrRank[i].leftRank / exp) % b] - 1] = substrRank[i];
-				count[(substrRank[i].leftRank / exp) % b]--;
+				h++;
 			}
-			substrRank = output;
-		};
-		for (int exp = 1; max / exp > 0; exp *= b)
-		{
-			countSort(exp);
+			lcp[rank[i]] = h;
+			h = std::max(h - 1, 0);
 		}
 	}
-	void SortRight(std::vector<Rank> &substrRank, int b)
+	// child table of the enhanced suffix array, the up, down and next l-index values share one slot per index:
+	// up[i] sits in cld[i - 1], down[i] and next[i] in cld[i], no two of them are ever defined for the same slot
+	void BuildChildTable()
 	{
-		int max = 0;
-		for (const Rank &elem : substrRank)
+		int n = sa.size();
+		cld.assign(n + 1, -1);
+		std::vector<int> stack{0};
+		for (int i = 1; i <= n; ++i)
 		{
-			if (max < elem.rightRank)
+			int last = -1;
+			while (lcp[i] < lcp[stack.back()])
 			{
-				max = elem.rightRank;
+				last = stack.back();
+				stack.pop_back();
+				if (lcp[i] <= lcp[stack.back()] && lcp[stack.back()] != lcp[last])
+				{
+					cld[stack.back()] = last; // down
+				}
+			}
+			if (last != -1)
+			{
+				cld[i - 1] = last; // up[i]
 			}
+			stack.push_back(i);
 		}
-		std::function<void(int)> countSort = [&substrRank, &b](int exp) {
-			std::vector<Rank> output(substrRank.size());
-			std::vector<int> count(b, 0);
-			for (int i = 0; i < substrRank.size(); ++i)
+		stack.assign(1, 0);
+		for (int i = 1; i <= n; ++i)
+		{
+			while (lcp[i] < lcp[stack.back()])
 			{
-				count[(substrRank[i].rightRank / exp) % b]++;
+				stack.pop_back();
 			}
-			for (int i = 1; i < count.size(); ++i)
+			if (lcp[i] == lcp[stack.back()])
 			{
-				count[i] += count[i - 1];
+				cld[stack.back()] = i; // next l-index
+				stack.pop_back();
 			}
-			for (int i = substrRank.size() - 1; i >= 0; --i)
+			stack.push_back(i);
+		}
+	}
+	// first l-index of the lcp-interval [i, j], i < j
+	int FirstLIndex(int i, int j) const
+	{
+		return i < cld[j] && cld[j] <= j ? cld[j] : cld[i];
+	}
+	// narrow the lcp-interval [i, j], whose suffixes share depth codepoints, to its child interval continuing with c
+	bool ChildInterval(int &i, int &j, int depth, char32_t c) const
+	{
+		auto startsWith = [&](int k) { return sa[k] + depth < str.size() && str[sa[k] + depth] == c; };
+		if (i == j)
+		{
+			return startsWith(i);
+		}
+		int l = i;
+		for (int r = FirstLIndex(i, j); r != -1;)
+		{
+			if (startsWith(l))
 			{
-				output[count[(substrRank[i].rightRank / exp) % b] - 1] = substrRank[i];
-				count[(substrRank[i].rightRank / exp) % b]--;
+				j = r - 1;
+				i = l;
+				return true;
 			}
-			substrRank = output;
-		};
-		for (int exp = 1; max / exp > 0; exp *= b)
+			l = r;
+			r = cld[l] > l && lcp[cld[l]] == lcp[l] ? cld[l] : -1;
+		}
+		if (startsWith(l))
 		{
-			countSort(exp);
+			i = l;
+			return true;
 		}
+		return false;
 	}
-	void Sort(std::vector<Rank> &substrRank)
+	// distance from each position of the text to the end of its key
+	std::vector<int> KeyEnds() const
 	{
-		int b = 10000;
-		SortRight(substrRank, b);
-		SortLeft(substrRank, b);
+		std::vector<int> toEnd(str.size());
+		for (int i = str.size() - 1, d = 0; i >= 0; --i)
+		{
+			d = str[i] == U'\0' ? 0 : d + 1;
+			toEnd[i] = d;
+		}
+		return toEnd;
 	}
-	void Collect(int lower, int upper, int size, std::vector<std::string> &collection)
+	void BuildKeyRanks()
 	{
-		std::vector<int> collected;
+		keyRanks.resize(separators.size());
+		collected.assign(values.size(), false);
+		for (int w = 0, rank = 0; w < separators.size(); ++w)
+		{
+			keyRanks[w] = rank;
+			rank += std::popcount(separators[w]);
+		}
+	}
+	// index of the key the suffix starting at pos belongs to
+	int KeyOf(int pos) const
+	{
+		uint64_t below = separators[pos / 64] & ((1ull << pos % 64) - 1);
+		return keyRanks[pos / 64] + std::popcount(below);
+	}
+	void Collect(int lower, int upper, std::vector<std::string> &collection)
+	{
+		std::vector<int> keys;
 		for (int i = lower; i < upper; ++i)
 		{
-			int j = sa[i] + size;
-			while (str[j] != U'\0')
-			{
-				j = j + 1;
-			}
-			auto iter = sate.Find(j);
-			if (iter != sate.End() && (*iter.second).back() != 1)
+			int key = KeyOf(sa[i]);
+			if (!collected[key])
 			{
-				collected.push_back(j);
-				collection.push_back(*iter.second);
-				(*iter.second).push_back(1);
+				collected[key] = true;
+				keys.push_back(key);
+				collection.push_back(values[key]);
 			}
 		}
-		for (const auto j : collected)
+		for (int key : keys)
 		{
-			sate[j].pop_back();
+			collected[key] = false;
 		}
 	}
 
   public:
+	// map the text onto a dense alphabet, 0 being a sentinel below every codepoint, and sort it with SA-IS
+	// then derive the lcp array and the child table used by Find, and the key ranks used to collect matches
 	void Build()
 	{
-		std::vector<Rank> substrRank(str.size());
-		std::vector<int> rank(str.size());
-		sa.resize(str.size());
-		for (int i = 0; i < str.size(); ++i)
+		char32_t max = 0;
+		for (char32_t c : str)
 		{
-			substrRank[i].leftRank = static_cast<int>(str[i]);
-			if (i < str.size() - 1)
-			{
-				substrRank[i].rightRank = static_cast<int>(str[i + 1]);
-			}
-			else
-			{
-				substrRank[i].rightRank = 0;
-			}
-			substrRank[i].index = i;
+			max = std::max(max, c);
 		}
-		Sort(substrRank);
-		for (int l = 2; l < str.size(); l = l * 2)
+		std::vector<int> alphabet(str.empty() ? 0 : max + 1, 0);
+		for (char32_t c : str)
 		{
-			MakeRanks(substrRank, rank);
-			for (int i = 0; i < str.size(); ++i)
-			{
-				substrRank[i].leftRank = rank[i];
-				if (i + l < str.size())
-				{
-					substrRank[i].rightRank = rank[i + l];
-				}
-				else
-				{
-					substrRank[i].rightRank = 0;
-				}
-				substrRank[i].index = i;
-			}
-			Sort(substrRank);
+			alphabet[c] = 1;
+		}
+		int k = 1;
+		for (int &c : alphabet)
+		{
+			c = c != 0 ? k++ : 0;
 		}
+		std::vector<int> s(str.size() + 1, 0);
 		for (int i = 0; i < str.size(); ++i)
 		{
-			sa[i] = substrRank[i].index;
+			s[i] = alphabet[str[i]];
 		}
+		std::vector<int>().swap(alphabet);
+		InducedSort(s, k, sa);
+		sa.erase(sa.begin()); // the sentinel suffix
+		BuildLcp();
+		BuildChildTable();
+		BuildKeyRanks();
 	}
 	void Add(std::string key, std::string value)
 	{
@@ -189,7 +331,9 @@ class SuffixArray
 			return;
 		}
 		str += una::utf8to32u(una::norm::to_nfd_utf8(key));
-		sate[str.size()] = value;
+		values.push_back(value);
+		separators.resize(str.size() / 64 + 1, 0);
+		separators[str.size() / 64] |= 1ull << str.size() % 64;
 		str += U'\0';
 	}
 	std::vector<std::string> Find(std::string key)
@@ -198,58 +342,57 @@ class SuffixArray
 		{
 			return {};
 		}
-		int lower = 0;
-		int upper = sa.size();
 		std::u32string u32str = una::utf8to32u(una::norm::to_nfd_utf8(key));
-		for (int i = 0; i < u32str.size(); ++i)
+		// walk down the lcp-interval tree, only branching codepoints need a look at the children
+		int lower = 0, upper = sa.size() - 1;
+		for (int depth = 0; depth < u32str.size();)
 		{
-			lower = [this, &i, &u32str](int l, int h) -> int {
-				int ans = h--;
-				while (l <= h)
-				{
-					int m = l + (h - l) / 2;
-					if (str[sa[m] + i] >= u32str[i])
-					{
-						ans = m;
-						h = m - 1;
-					}
-					else
-					{
-						l = m + 1;
-					}
-				}
-				return ans;
-			}(lower, upper);
-			if (lower >= sa.size() || str[sa[lower] + i] != u32str[i])
+			if (sa.empty() || !ChildInterval(lower, upper, depth, u32str[depth]))
 			{
 				return {};
 			}
-			upper = [this, &i, &u32str](int l, int h) -> int {
-				int ans = h--;
-				while (l <= h)
+			int next = lower == upper ? u32str.size() : std::min<int>(lcp[FirstLIndex(lower, upper)], u32str.size());
+			for (depth += 1; depth < next; ++depth)
+			{
+				if (sa[lower] + depth >= str.size() || str[sa[lower] + depth] != u32str[depth])
 				{
-					int m = l + (h - l) / 2;
-					if (str[sa[m] + i] > u32str[i])
-					{
-						ans = m;
-						h = m - 1;
-					}
-					else
-					{
-						l = m + 1;
-					}
+					return {};
 				}
-				return ans;
-			}(lower, upper);
-			if (lower > upper)
-			{
-				return {};
 			}
 		}
+		upper += 1;
 		std::vector<std::string> collection;
-		Collect(lower, upper, u32str.size(), collection);
+		Collect(lower, upper, collection);
 		return collection;
 	}
+	// the longest substring of the keys that occurs at least twice
+	std::string LongestRepeat() const
+	{
+		std::vector<int> toEnd = KeyEnds();
+		int best = 0, at = 0;
+		for (int i = 1; i < sa.size(); ++i)
+		{
+			int len = std::min(lcp[i], toEnd[sa[i]]);
+			if (len > best)
+			{
+				best = len;
+				at = sa[i];
+			}
+		}
+		return una::norm::to_nfc_utf8(una::utf32to8(std::u32string_view(str).substr(at, best)));
+	}
+	// the number of distinct non-empty substrings of the keys, a suffix adds the prefixes it does not share
+	// with the previous one
+	long long DistinctSubstrings() const
+	{
+		std::vector<int> toEnd = KeyEnds();
+		long long count = 0;
+		for (int i = 0; i < sa.size(); ++i)
+		{
+			count += toEnd[sa[i]] - std::min(std::max(lcp[i], 0), toEnd[sa[i]]);
+		}
+		return count;
+	}
 	void Print()
 	{
 		for (int i : sa)
@@ -0,0 +1,224 @@
+#pragma once
+#include "child-map.h"
+#include "red_black_tree.h"
+#include <algorithm>
+#include <cstdint>
+#include <map>
+#include <utility>
+#include <vector>
+
+/* Edge storage policies for BasicSuffixTreeRB.
+ * Every node carries a Slot, and the tree goes through the policy to read or write the edges of a node, passing both
+ * the node's slot and its index. Per-node policies keep the children inside the slot, HashEdges keeps every edge of
+ * the tree in one table and only leaves a small list head in the slot.
+ * Child index 0 is the root, which is never a child, so Find returns 0 for a missing edge.
+ * ForEach visits the edges of a node in increasing order of their first character.
+ */
+
+struct ChildMapEdges
+{
+	using Slot = ChildMap;
+
+	int Find(const Slot &slot, int, char32_t c) const
+	{
+		return slot.Find(c);
+	}
+	void Set(Slot &slot, int, char32_t c, int child)
+	{
+		slot.Set(c, child);
+	}
+	template <typename Visit> void ForEach(const Slot &slot, int, Visit visit) const
+	{
+		slot.ForEach(visit);
+	}
+	uint32_t Size(const Slot &slot, int) const
+	{
+		return slot.Size();
+	}
+	void Clear(){};
+};
+
+struct MapEdges
+{
+	using Slot = std::map<char32_t, int>;
+
+	int Find(const Slot &slot, int, char32_t c) const
+	{
+		auto child = slot.find(c);
+		return child == slot.end() ? 0 : child->second;
+	}
+	void Set(Slot &slot, int, char32_t c, int child)
+	{
+		slot[c] = child;
+	}
+	template <typename Visit> void ForEach(const Slot &slot, int, Visit visit) const
+	{
+		for (const auto &child : slot)
+		{
+			visit(child.first, child.second);
+		}
+	}
+	uint32_t Size(const Slot &slot, int) const
+	{
+		return slot.size();
+	}
+	void Clear(){};
+};
+
+struct RBTreeEdges
+{
+	using Slot = RBTree<char32_t, int>;
+
+	int Find(const Slot &slot, int, char32_t c) const
+	{
+		auto child = slot.Find(c);
+		return child == slot.End() ? 0 : *child.second;
+	}
+	void Set(Slot &slot, int, char32_t c, int child)
+	{
+		slot[c] = child;
+	}
+	template <typename Visit> void ForEach(const Slot &slot, int, Visit visit) const
+	{
+		for (auto child = slot.Begin(); child != slot.End(); ++child)
+		{
+			visit(*child.first, *child.second);
+		}
+	}
+	uint32_t Size(const Slot &slot, int) const
+	{
+		return slot.Size();
+	}
+	void Clear(){};
+};
+
+/* All edges of the tree in a single open-addressing table keyed by (node, first character), with linear probing and
+ * at most half of the buckets in use. Building the tree performs no allocation beyond doubling the table.
+ * The edges of a node are additionally chained by character through the table, starting at the slot, so ForEach can
+ * enumerate them; it sorts them on the fly, which is fine for the listing and collecting walks that need it.
+ */
+class HashEdges
+{
+  public:
+	struct Slot
+	{
+		uint32_t degree = 0;
+		char32_t first = 0; // character of the most recently added edge, meaningless while degree is 0
+	};
+
+  private:
+	struct Entry
+	{
+		int node;		  // -1 marks an empty bucket
+		char32_t c;
+		int child;
+		char32_t sibling; // character of the edge added to the same node before this one
+	};
+
+  private:
+	std::vector<Entry> table;
+	size_t used = 0;
+
+  private:
+	static size_t Hash(int node, char32_t c)
+	{
+		uint64_t key = (uint64_t)(uint32_t)node << 32 | c;
+		key ^= key >> 33;
+		key *= 0xFF51AFD7ED558CCDull;
+		key ^= key >> 33;
+		return key;
+	}
+	const Entry *Lookup(int node, char32_t c) const
+	{
+		if (table.empty())
+		{
+			return nullptr;
+		}
+		size_t mask = table.size() - 1;
+		for (size_t i = Hash(node, c) & mask;; i = (i + 1) & mask)
+		{
+			if (table[i].node == node && table[i].c == c)
+			{
+				return &table[i];
+			}
+			if (table[i].node == -1)
+			{
+				return nullptr;
+			}
+		}
+	}
+	Entry &Bucket(int node, char32_t c)
+	{
+		size_t mask = table.size() - 1;
+		size_t i = Hash(node, c) & mask;
+		while (table[i].node != -1 && (table[i].node != node || table[i].c != c))
+		{
+			i = (i + 1) & mask;
+		}
+		return table[i];
+	}
+	void Grow()
+	{
+		std::vector<Entry> old(std::max<size_t>(table.size() * 2, 16), Entry{-1, 0, 0, 0});
+		old.swap(table);
+		for (const Entry &entry : old)
+		{
+			if (entry.node != -1)
+			{
+				Bucket(entry.node, entry.c) = entry;
+			}
+		}
+	}
+
+  public:
+	int Find(const Slot &, int node, char32_t c) const
+	{
+		const Entry *entry = Lookup(node, c);
+		return entry == nullptr ? 0 : entry->child;
+	}
+	void Set(Slot &slot, int node, char32_t c, int child)
+	{
+		if ((used + 1) * 2 > table.size())
+		{
+			Grow();
+		}
+		Entry &entry = Bucket(node, c);
+		if (entry.node == -1)
+		{
+			entry = Entry{node, c, child, slot.first};
+			slot.first = c;
+			slot.degree++;
+			used++;
+		}
+		else
+		{
+			entry.child = child;
+		}
+	}
+	template <typename Visit> void ForEach(const Slot &slot, int node, Visit visit) const
+	{
+		std::vector<std::pair<char32_t, int>> children;
+		children.reserve(slot.degree);
+		char32_t c = slot.first;
+		for (uint32_t i = 0; i < slot.degree; ++i)
+		{
+			const Entry *entry = Lookup(node, c);
+			children.emplace_back(c, entry->child);
+			c = entry->sibling;
+		}
+		std::sort(children.begin(), children.end());
+		for (const auto &child : children)
+		{
+			visit(child.first, child.second);
+		}
+	}
+	uint32_t Size(const Slot &slot, int) const
+	{
+		return slot.degree;
+	}
+	void Clear()
+	{
+		table.clear();
+		used = 0;
+	}
+};
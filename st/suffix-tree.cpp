@@ -2,6 +2,8 @@
 #include "suffix-tree.h"
 #include <chrono>
 #include <fstream>
+#include <functional>
+#include <limits>
 #include <Windows.h>
 
 // void StressBuildTest()
@@ -77,6 +79,7 @@ void SmallTest()
 	st.Add((const char *)u8"- (máy tính) số hạng thứ hai", (const char *)u8"augend");
 	st.Add((const char *)u8"sự gần đúng, phép xấp xỉ, cách tiếp cận; radial a. gl. ghép xấp xỉ theo tia ",
 		   (const char *)u8"approach");
+	st.BuildIndex();
 	std::cout << "Build validity:\n";
 
 	std::u32string test = una::utf8to32u(una::norm::to_nfd_utf8((const char *)u8"thử"));
@@ -97,6 +100,7 @@ void SmallTest()
 	std::cout << (st.Validate() ? "Valid suffix tree\n" : "Invalid suffix tree\n");
 
 	st.Serialize((const char *)u8"./seri", (const char *)u8"small-strb");
+	st.SerializeFlat((const char *)u8"./seri", (const char *)u8"small-strb");
 }
 
 void SmallLoadTest()
@@ -121,6 +125,98 @@ void SmallLoadTest()
 	st.List();
 
 	std::cout << (st.Validate() ? "Valid suffix tree\n" : "Invalid suffix tree\n");
+
+	MappedSuffixTree mst;
+	if (!mst.Open((const char *)u8"./seri", (const char *)u8"small-strb"))
+	{
+		std::cout << "Cannot map the flat file\n";
+		return;
+	}
+	std::cout << "Mapped search result(s) for " << query << ":\n";
+	for (const auto &kvPair : mst.Find(query))
+	{
+		std::cout << "key: " << kvPair.key << "; value: " << kvPair.value << '\n';
+	}
+}
+
+// rewrite the tree file of filename with one field changed by corrupt, delimited trees store their delimiter first
+template <typename Corrupt> bool CorruptTreeFile(const std::string &filename, bool delimited, Corrupt corrupt)
+{
+	serial::Reader textIn, treeIn;
+	int textSize;
+	if (!textIn.Load("./seri/" + filename + ".text", serial::TEXT) || !textIn.Get(textSize) ||
+		!treeIn.Load("./seri/" + filename + ".tree", serial::TREE))
+	{
+		return false;
+	}
+	char32_t delim = 0;
+	int state[6], treeSize, edgeCount;
+	std::vector<int> starts, ends, links, childCounts, childNodes;
+	std::vector<char32_t> childChars;
+	if ((delimited && !treeIn.Get(delim)) || !treeIn.Get(state, 6) || !treeIn.Get(treeSize) ||
+		!treeIn.Get(starts, treeSize) || !treeIn.Get(ends, treeSize) || !treeIn.Get(links, treeSize) ||
+		!treeIn.Get(childCounts, treeSize) || !treeIn.Get(edgeCount) || !treeIn.Get(childChars, edgeCount) ||
+		!treeIn.Get(childNodes, edgeCount))
+	{
+		return false;
+	}
+	corrupt(textSize, state, starts, ends, links);
+
+	serial::Writer treeOut;
+	if (delimited)
+	{
+		treeOut.Put(delim);
+	}
+	treeOut.Put(state, 6);
+	treeOut.Put(treeSize);
+	treeOut.Put(starts);
+	treeOut.Put(ends);
+	treeOut.Put(links);
+	treeOut.Put(childCounts);
+	treeOut.Put(edgeCount);
+	treeOut.Put(childChars);
+	treeOut.Put(childNodes);
+	return treeOut.Save("./seri/" + filename + ".tree", serial::TREE);
+}
+
+// save a small tree, corrupt one field of its tree file at a time and check that loading it back fails
+template <typename Tree> bool CorruptLoadTest(const std::string &filename, bool delimited)
+{
+	using Fields = std::vector<int>;
+	const int oo = std::numeric_limits<int>::max();
+	auto firstNode = [](const Fields &ends, bool leaf) {
+		int i = 1;
+		while ((ends[i] == oo) != leaf)
+		{
+			++i;
+		}
+		return i;
+	};
+	std::vector<std::function<void(int, int *, Fields &, Fields &, Fields &)>> corruptions = {
+		[](int, int *, Fields &, Fields &, Fields &) {},
+		[](int textSize, int *, Fields &starts, Fields &, Fields &) { starts[1] = textSize + 1; },
+		[&](int textSize, int *, Fields &, Fields &ends, Fields &) { ends[firstNode(ends, false)] = textSize + 1; },
+		[&](int, int *, Fields &, Fields &ends, Fields &links) { links[firstNode(ends, true)] = 1; },
+		[](int, int *state, Fields &starts, Fields &, Fields &) { state[1] = starts.size(); },
+		[](int textSize, int *state, Fields &, Fields &, Fields &) { state[4] = textSize + 1; },
+		[](int textSize, int *state, Fields &, Fields &, Fields &) { state[5] = textSize + 1; },
+	};
+
+	Tree st;
+	st.Add("banana", "fruit");
+	st.Add("bandana", "scarf");
+	st.Add("cabana", "hut");
+	for (size_t i = 0; i < corruptions.size(); ++i)
+	{
+		Tree loaded;
+		// the untouched file must still load, every corrupted one must be rejected
+		if (!st.Serialize("./seri", filename) || !CorruptTreeFile(filename, delimited, corruptions[i]) ||
+			loaded.Deserialize("./seri", filename) != (i == 0))
+		{
+			return false;
+		}
+	}
+	return true;
 }
 
 #include "suffix-arr.h"
@@ -128,8 +224,58 @@ void SmallLoadTest()
 #include <fstream>
 #include <random>
 #include <string>
+#include <string_view>
 
-int main()
+// build a tree over the dictionary headwords and time it together with one-letter queries
+template <typename Tree>
+void EdgeStorageBenchmark(const char *name, const std::vector<std::pair<std::string, std::string>> &dict)
+{
+	Tree st;
+	auto start = std::chrono::steady_clock::now();
+	for (const auto &entry : dict)
+	{
+		st.Add(entry.first, entry.second);
+	}
+	st.BuildIndex();
+	auto end = std::chrono::steady_clock::now();
+	std::cout << name << ": build " << std::chrono::duration_cast<std::chrono::milliseconds>(end - start).count()
+			  << " ms, " << st.Size() << " nodes";
+
+	size_t found = 0;
+	start = std::chrono::steady_clock::now();
+	for (char c = 'a'; c <= 'z'; ++c)
+	{
+		found += st.Find(std::string() + c).size();
+	}
+	end = std::chrono::steady_clock::now();
+	std::cout << ", find " << std::chrono::duration_cast<std::chrono::milliseconds>(end - start).count() << " ms ("
+			  << found << " results)\n";
+}
+
+void EdgeStorageBenchmark()
+{
+	std::vector<std::pair<std::string, std::string>> dict;
+	std::fstream fin("data/anh_viet.txt");
+	std::string line;
+	while (std::getline(fin, line))
+	{
+		if (line[0] == '@')
+		{
+			dict.emplace_back(line.substr(1), std::string());
+		}
+		else if (line[0] == '-' && !dict.empty())
+		{
+			dict.back().second += line.substr(1) + '\n';
+		}
+	}
+	EdgeStorageBenchmark<BasicSuffixTreeRB<ChildMapEdges>>("child map", dict);
+	EdgeStorageBenchmark<BasicSuffixTreeRB<RBTreeEdges>>("rb tree", dict);
+	EdgeStorageBenchmark<BasicSuffixTreeRB<MapEdges>>("std::map", dict);
+	EdgeStorageBenchmark<BasicSuffixTreeRB<HashEdges>>("hash table", dict);
+}
+
+// pass "bench" on the command line to also compare the edge storage policies
+int main(int argc, char *argv[])
 {
 	SetConsoleOutputCP(CP_UTF8);
 
@@ -169,5 +315,14 @@ int main()
 		std::cout << std::chrono::duration_cast<std::chrono::milliseconds>(end - start).count() << '\n';
 	}
 
+	std::cout << (CorruptLoadTest<SuffixTreeRB>("corrupt-strb", false) && CorruptLoadTest<SuffixTree>("corrupt-st", true)
+					  ? "Corrupt tree files rejected\n"
+					  : "Corrupt tree file loaded\n");
+
+	if (argc > 1 && std::string_view(argv[1]) == "bench")
+	{
+		EdgeStorageBenchmark();
+	}
+
 	return 0;
 }
@@ -1,4 +1,5 @@
 #pragma once
+#include "serial.h"
 #include <filesystem>
 #include <fstream>
 #include <iostream>
@@ -6,6 +7,8 @@
 #include <map> // red black tree
 #include <string>
 #include <uni_algo/all.h>
+#include <unordered_set>
+#include <utility>
 #include <vector>
 
 //
@@ -207,26 +210,27 @@ class SuffixTree
 		}
 	}
 
+	// print every suffix below node, depth first with an explicit stack since the tree can be as deep as the longest
+	// key; u32str holds the path from the root and is reused for every suffix
 	void List(std::u32string &u32str, int node) const
 	{
-		if (tree[node].end == oo)
+		std::vector<std::pair<int, size_t>> stack{{node, u32str.size()}};
+		while (!stack.empty())
 		{
-			for (int i = tree[node].start; i < text.size(); ++i)
+			auto [curNode, depth] = stack.back();
+			stack.pop_back();
+			u32str.resize(depth);
+			int end = tree[curNode].IsLeaf() ? text.size() : tree[curNode].end;
+			u32str.append(text, std::max(tree[curNode].start, 0), std::max(end - tree[curNode].start, 0));
+			if (tree[curNode].IsLeaf())
 			{
-				u32str.push_back(text[i]);
+				std::cout << una::norm::to_nfc_utf8(una::utf32to8(u32str)) << '\n';
+				continue;
+			}
+			for (auto next = tree[curNode].next.rbegin(); next != tree[curNode].next.rend(); ++next)
+			{
+				stack.emplace_back(next->second, u32str.size());
 			}
-			std::cout << una::norm::to_nfc_utf8(una::utf32to8(u32str)) << '\n';
-			return;
-		}
-		for (int i = tree[node].start; i < tree[node].end; ++i)
-		{
-			u32str.push_back(text[i]);
-		}
-		for (const auto &next : tree[node].next)
-		{
-			auto orig = u32str.size();
-			List(u32str, next.second);
-			u32str.resize(orig);
 		}
 	}
 
@@ -271,62 +275,79 @@ class SuffixTree
 			return false;
 		}
 
-		std::ofstream textFileOut(directory / (const char8_t *)(filename + ".text").c_str(),
-								  std::ios::out | std::ios::binary);
-		std::ofstream treeFileOut(directory / (const char8_t *)(filename + ".tree").c_str(),
-								  std::ios::out | std::ios::binary);
-		std::ofstream sateFileOut(directory / (const char8_t *)(filename + ".sate").c_str(),
-								  std::ios::out | std::ios::binary);
-		if (!textFileOut || !treeFileOut || !sateFileOut)
-		{
-			return false;
-		}
-
-		int textSize = text.size();
-		textFileOut.write((const char *)&textSize, sizeof(textSize));
-		textFileOut.write((const char *)text.c_str(), textSize * sizeof(char32_t));
+		serial::Writer textOut;
+		textOut.Put((int)text.size());
+		textOut.Put(text.data(), text.size());
 
+		// struct of arrays: key lengths, key positions, end offsets of the values, then all values back to back
 		int satCnt = satellite.size();
-		sateFileOut.write((const char *)&satCnt, sizeof(satCnt));
+		std::vector<int> keyLens, keyPoss;
+		std::vector<uint64_t> dataEnds;
+		keyLens.reserve(satCnt);
+		keyPoss.reserve(satCnt);
+		dataEnds.reserve(satCnt);
+		uint64_t dataEnd = 0;
 		for (const auto &sat : satellite)
 		{
-			int dataSize = sat.data.size();
-			sateFileOut.write((const char *)&dataSize, sizeof(dataSize));
-			sateFileOut.write((const char *)sat.data.c_str(), dataSize * sizeof(char));
-			sateFileOut.write((const char *)&sat.keyLen, sizeof(sat.keyLen));
-			sateFileOut.write((const char *)&sat.keyPos, sizeof(sat.keyPos));
+			keyLens.push_back(sat.keyLen);
+			keyPoss.push_back(sat.keyPos);
+			dataEnds.push_back(dataEnd += sat.data.size());
+		}
+		serial::Writer sateOut;
+		sateOut.Put(satCnt);
+		sateOut.Put(keyLens);
+		sateOut.Put(keyPoss);
+		sateOut.Put(dataEnds);
+		for (const auto &sat : satellite)
+		{
+			sateOut.Put(sat.data.data(), sat.data.size());
 		}
 
-		// This maybe is not needed
-		treeFileOut.write((const char *)&root, sizeof(root));
-		treeFileOut.write((const char *)&needSL, sizeof(needSL));
-		treeFileOut.write((const char *)&remainder, sizeof(remainder));
-		//
-
-		treeFileOut.write((const char *)&activeNode, sizeof(activeNode));
-		treeFileOut.write((const char *)&activeEdge, sizeof(activeEdge));
-		treeFileOut.write((const char *)&activeLength, sizeof(activeLength));
-
+		// struct of arrays: starts, ends, links, child counts, then the children of all nodes in order
 		int treeSize = tree.size();
-		treeFileOut.write((const char *)&treeSize, sizeof(treeSize));
-		for (const auto &node : tree)
+		std::vector<int> starts, ends, links, childCounts, childNodes;
+		std::vector<char32_t> childChars;
+		starts.reserve(treeSize);
+		ends.reserve(treeSize);
+		links.reserve(treeSize);
+		childCounts.reserve(treeSize);
+		childNodes.reserve(treeSize);
+		childChars.reserve(treeSize);
+		for (int i = 0; i < treeSize; ++i)
 		{
-			treeFileOut.write((const char *)&node.start, sizeof(node.start));
-			treeFileOut.write((const char *)&node.end, sizeof(node.end));
-			treeFileOut.write((const char *)&node.link, sizeof(node.link));
-			int mapSize = node.next.size();
-			treeFileOut.write((const char *)&mapSize, sizeof(mapSize));
-			for (const auto &pair : node.next)
+			starts.push_back(tree[i].start);
+			ends.push_back(tree[i].end);
+			links.push_back(tree[i].link);
+			childCounts.push_back(tree[i].next.size());
+			for (const auto &pair : tree[i].next)
 			{
-				treeFileOut.write((const char *)&pair.first, sizeof(pair.first));
-				treeFileOut.write((const char *)&pair.second, sizeof(pair.second));
+				childChars.push_back(pair.first);
+				childNodes.push_back(pair.second);
 			}
 		}
-
-		return true;
+		serial::Writer treeOut;
+		treeOut.Put(delim);
+		treeOut.Put(root);
+		treeOut.Put(needSL);
+		treeOut.Put(remainder);
+		treeOut.Put(activeNode);
+		treeOut.Put(activeEdge);
+		treeOut.Put(activeLength);
+		treeOut.Put(treeSize);
+		treeOut.Put(starts);
+		treeOut.Put(ends);
+		treeOut.Put(links);
+		treeOut.Put(childCounts);
+		treeOut.Put((int)childNodes.size());
+		treeOut.Put(childChars);
+		treeOut.Put(childNodes);
+
+		return textOut.Save(directory / (const char8_t *)(filename + ".text").c_str(), serial::TEXT) &&
+			   treeOut.Save(directory / (const char8_t *)(filename + ".tree").c_str(), serial::TREE) &&
+			   sateOut.Save(directory / (const char8_t *)(filename + ".sate").c_str(), serial::SATE);
 	}
 
-	// Load the data from files
+	// Load the data from files, the tree is left untouched if they are missing or corrupted
 	bool Deserialize(std::filesystem::path directory, std::string filename)
 	{
 		if (!std::filesystem::is_directory(directory))
@@ -334,65 +355,102 @@ class SuffixTree
 			return false;
 		}
 
-		std::ifstream textFileIn(directory / (const char8_t *)(filename + ".text").c_str(),
-								 std::ios::in | std::ios::binary);
-		std::ifstream treeFileIn(directory / (const char8_t *)(filename + ".tree").c_str(),
-								 std::ios::in | std::ios::binary);
-		std::ifstream sateFileIn(directory / (const char8_t *)(filename + ".sate").c_str(),
-								 std::ios::in | std::ios::binary);
-		if (!textFileIn || !treeFileIn || !sateFileIn)
+		serial::Reader textIn, treeIn, sateIn;
+		if (!textIn.Load(directory / (const char8_t *)(filename + ".text").c_str(), serial::TEXT) ||
+			!treeIn.Load(directory / (const char8_t *)(filename + ".tree").c_str(), serial::TREE) ||
+			!sateIn.Load(directory / (const char8_t *)(filename + ".sate").c_str(), serial::SATE))
 		{
 			return false;
 		}
 
 		int textSize;
-		textFileIn.read((char *)&textSize, sizeof(textSize));
-		text.resize(textSize);
-		textFileIn.read((char *)text.data(), textSize * sizeof(char32_t));
+		std::vector<char32_t> u32text;
+		if (!textIn.Get(textSize) || textSize < 0 || !textIn.Get(u32text, textSize) || !textIn.Done())
+		{
+			return false;
+		}
 
 		int satCnt;
-		sateFileIn.read((char *)&satCnt, sizeof(satCnt));
-		satellite.resize(satCnt);
-		for (auto &sat : satellite)
+		std::vector<int> keyLens, keyPoss;
+		std::vector<uint64_t> dataEnds;
+		if (!sateIn.Get(satCnt) || satCnt < 0 || !sateIn.Get(keyLens, satCnt) || !sateIn.Get(keyPoss, satCnt) ||
+			!sateIn.Get(dataEnds, satCnt))
 		{
-			int dataSize;
-			sateFileIn.read((char *)&dataSize, sizeof(dataSize));
-			sat.data.resize(dataSize);
-			sateFileIn.read((char *)sat.data.data(), dataSize * sizeof(char));
-			sateFileIn.read((char *)&sat.keyLen, sizeof(sat.keyLen));
-			sateFileIn.read((char *)&sat.keyPos, sizeof(sat.keyPos));
+			return false;
+		}
+		std::vector<Satellite> sats(satCnt);
+		uint64_t dataBegin = 0;
+		for (int i = 0; i < satCnt; ++i)
+		{
+			if (keyLens[i] < 0 || keyPoss[i] < 0 || keyPoss[i] > textSize - keyLens[i] || dataEnds[i] < dataBegin)
+			{
+				return false;
+			}
+			sats[i].keyLen = keyLens[i];
+			sats[i].keyPos = keyPoss[i];
+			sats[i].data.resize(dataEnds[i] - dataBegin);
+			if (!sateIn.Get(sats[i].data.data(), sats[i].data.size()))
+			{
+				return false;
+			}
+			dataBegin = dataEnds[i];
+		}
+		if (!sateIn.Done())
+		{
+			return false;
 		}
 
-		// This maybe is not needed
-		treeFileIn.read((char *)&root, sizeof(root));
-		treeFileIn.read((char *)&needSL, sizeof(needSL));
-		treeFileIn.read((char *)&remainder, sizeof(remainder));
-		//
-
-		treeFileIn.read((char *)&activeNode, sizeof(activeNode));
-		treeFileIn.read((char *)&activeEdge, sizeof(activeEdge));
-		treeFileIn.read((char *)&activeLength, sizeof(activeLength));
+		char32_t nextDelim;
+		int state[6], treeSize, edgeCount;
+		std::vector<int> starts, ends, links, childCounts, childNodes;
+		std::vector<char32_t> childChars;
+		if (!treeIn.Get(nextDelim) || !treeIn.Get(state, 6) || !treeIn.Get(treeSize) || treeSize <= 0 ||
+			!treeIn.Get(starts, treeSize) || !treeIn.Get(ends, treeSize) || !treeIn.Get(links, treeSize) ||
+			!treeIn.Get(childCounts, treeSize) || !treeIn.Get(edgeCount) || edgeCount < 0 ||
+			!treeIn.Get(childChars, edgeCount) || !treeIn.Get(childNodes, edgeCount) || !treeIn.Done())
+		{
+			return false;
+		}
+		if (!serial::CheckTree(textSize, satCnt, state, starts, ends, links))
+		{
+			return false;
+		}
 
-		int treeSize = tree.size();
-		treeFileIn.read((char *)&treeSize, sizeof(treeSize));
-		tree.resize(treeSize);
-		for (auto &node : tree)
+		std::vector<Node> nodes(treeSize);
+		int edge = 0;
+		for (int i = 0; i < treeSize; ++i)
 		{
-			treeFileIn.read((char *)&node.start, sizeof(node.start));
-			treeFileIn.read((char *)&node.end, sizeof(node.end));
-			treeFileIn.read((char *)&node.link, sizeof(node.link));
-			int mapSize = node.next.size();
-			treeFileIn.read((char *)&mapSize, sizeof(mapSize));
-			for (int i = 0; i < mapSize; ++i)
+			if (childCounts[i] < 0 || childCounts[i] > edgeCount - edge)
 			{
-				char32_t c;
-				int child;
-				treeFileIn.read((char *)&c, sizeof(c));
-				treeFileIn.read((char *)&child, sizeof(child));
-				node.next[c] = child;
+				return false;
 			}
+			nodes[i].start = starts[i];
+			nodes[i].end = ends[i];
+			nodes[i].link = links[i];
+			for (int j = 0; j < childCounts[i]; ++j, ++edge)
+			{
+				if (childNodes[edge] <= 0 || childNodes[edge] >= treeSize)
+				{
+					return false;
+				}
+				nodes[i].next[childChars[edge]] = childNodes[edge];
+			}
+		}
+		if (edge != edgeCount)
+		{
+			return false;
 		}
 
+		text.assign(u32text.begin(), u32text.end());
+		satellite = std::move(sats);
+		tree = std::move(nodes);
+		delim = nextDelim;
+		root = state[0];
+		needSL = state[1];
+		remainder = state[2];
+		activeNode = state[3];
+		activeEdge = state[4];
+		activeLength = state[5];
 		return true;
 	}
 
@@ -433,11 +491,20 @@ class SuffixTree
 		return true;
 	}
 
-	std::vector<KeyValue> Find(std::string key)
+	std::vector<KeyValue> Find(std::string key) const
 	{
+		std::vector<KeyValue> keyValue;
+		Find(key, keyValue);
+		return keyValue;
+	}
+
+	// Same as above, into a caller-supplied buffer which is cleared first, so repeated queries can reuse its storage
+	void Find(std::string key, std::vector<KeyValue> &keyValue) const
+	{
+		keyValue.clear();
 		if (key.empty() || !una::is_valid_utf8(key))
 		{
-			return {};
+			return;
 		}
 		std::u32string u32key = una::utf8to32u(una::norm::to_nfd_utf8(key));
 		int curNode = 0, curLength = 0;
@@ -448,7 +515,7 @@ class SuffixTree
 				const auto &child = tree[curNode].next.find(u32key[i]);
 				if (child == tree[curNode].next.end())
 				{
-					return {};
+					return;
 				}
 				curNode = child->second;
 				curLength = 1;
@@ -459,35 +526,34 @@ class SuffixTree
 			}
 			else
 			{
-				return {};
+				return;
 			}
 		}
-		std::vector<KeyValue> keyValue;
-		std::vector<int> collected;
-		Collect(curNode, keyValue, collected);
-		for (const auto &i : collected)
-		{
-			satellite[i].keyPos = -(satellite[i].keyPos + 1);
-		}
-		return keyValue;
+		Collect(curNode, keyValue);
 	}
 
-	void Collect(int curNode, std::vector<KeyValue> &keyValue, std::vector<int> &collected)
+	// append the entries of the leaves below curNode, each once, depth first with an explicit stack
+	void Collect(int curNode, std::vector<KeyValue> &keyValue) const
 	{
-		if (tree[curNode].IsLeaf())
+		std::unordered_set<int> collected; // only the reported entries, a query pays for its hits and not the tree
+		std::vector<int> stack{curNode};
+		while (!stack.empty())
 		{
-			int i = -tree[curNode].link;
-			if (satellite[i].keyPos >= 0)
+			int node = stack.back();
+			stack.pop_back();
+			if (tree[node].IsLeaf())
+			{
+				int i = -tree[node].link;
+				if (collected.insert(i).second)
+				{
+					keyValue.emplace_back(satellite[i], text);
+				}
+			}
+			for (auto child = tree[node].next.rbegin(); child != tree[node].next.rend(); ++child)
 			{
-				keyValue.emplace_back(satellite[i], text);
-				satellite[i].keyPos = -satellite[i].keyPos - 1; // minus 1 to ensure marked value is negative
-				collected.push_back(i);
+				stack.push_back(child->second);
 			}
 		}
-		for (const auto &child : tree[curNode].next)
-		{
-			Collect(child.second, keyValue, collected);
-		}
 	}
 
 	bool Validate() const
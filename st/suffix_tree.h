@@ -1,11 +1,17 @@
 #pragma once
-#include "red_black_tree.h"
+#include "flat-suffix-tree.h"
+#include "range-min.h"
+#include "serial.h"
+#include "suffix-edges.h"
+#include <algorithm>
 #include <filesystem>
 #include <fstream>
 #include <iostream>
 #include <limits>
 #include <string>
 #include <uni_algo/all.h>
+#include <unordered_set>
+#include <utility>
 #include <vector>
 
 //
@@ -45,7 +51,9 @@
 // `active point` and `remainder`, leaving the tree unchanged. BUT if there is an `internal node` marked as `needing
 // suffix link`, we must connect that node with our current `active node` through a `suffix link`.
 //
-class SuffixTreeRB
+// How the node-child edges are stored is up to the `Edges` policy, see suffix-edges.h.
+//
+template <typename Edges = ChildMapEdges> class BasicSuffixTreeRB
 {
   private:
 	// Define infinity constant, useful for canonization.
@@ -67,8 +75,8 @@ class SuffixTreeRB
 		int link;
 
 		// The node-child edges.
-		// This map the start character of the edge to the child node index.
-		RBTree<char32_t, int> next;
+		// This map the start character of the edge to the child node index, through the edge policy.
+		typename Edges::Slot next;
 
 	  public:
 		Node() : start(-1), end(-1), link(0){};
@@ -115,6 +123,13 @@ class SuffixTreeRB
 	std::u32string text;
 	std::vector<Node> tree;
 	std::vector<Satellite> satellite;
+	Edges edges;
+
+	// The document index, see BuildIndex.
+	bool indexed = false;
+	std::vector<int> leafBegin, leafEnd; // the leaves below node i are docs[leafBegin[i], leafEnd[i])
+	std::vector<int> docs;				 // satellite of every leaf, in depth-first order
+	RangeMin prevDoc;					 // previous position of the same satellite in docs, -1 if none
 
 	int root, needSL, remainder;
 
@@ -128,6 +143,21 @@ class SuffixTreeRB
 		return tree.size() - 1;
 	}
 
+	int Child(int node, char32_t c) const
+	{
+		return edges.Find(tree[node].next, node, c);
+	}
+
+	void SetChild(int node, char32_t c, int child)
+	{
+		edges.Set(tree[node].next, node, c, child);
+	}
+
+	template <typename Visit> void ForEachChild(int node, Visit visit) const
+	{
+		edges.ForEach(tree[node].next, node, visit);
+	}
+
 	char32_t ActiveEdge()
 	{
 		return text[activeEdge];
@@ -165,15 +195,15 @@ class SuffixTreeRB
 			{
 				activeEdge = text.size() - 1;
 			}
-			if (tree[activeNode].next.Find(ActiveEdge()) == tree[activeNode].next.End())
+			int next = Child(activeNode, ActiveEdge());
+			if (next == 0)
 			{
 				int leaf = NewNode(text.size() - 1, oo, satelliteLink);
-				tree[activeNode].next[ActiveEdge()] = leaf;
+				SetChild(activeNode, ActiveEdge(), leaf);
 				AddLink(activeNode); // rule 2
 			}
 			else
 			{
-				int next = tree[activeNode].next[ActiveEdge()];
 				if (WalkDown(next)) // observation 2
 				{
 					continue;
@@ -185,11 +215,11 @@ class SuffixTreeRB
 					break;
 				}
 				int split = NewNode(tree[next].start, tree[next].start + activeLength);
-				tree[activeNode].next[ActiveEdge()] = split;
+				SetChild(activeNode, ActiveEdge(), split);
 				int leaf = NewNode(text.size() - 1, oo, satelliteLink);
-				tree[split].next[c] = leaf;
+				SetChild(split, c, leaf);
 				tree[next].start += activeLength;
-				tree[split].next[text[tree[next].start]] = next;
+				SetChild(split, text[tree[next].start], next);
 				AddLink(split); // rule 2
 			}
 			remainder--;
@@ -205,31 +235,31 @@ class SuffixTreeRB
 		}
 	}
 
+	// print every suffix below node, depth first with an explicit stack since the tree can be as deep as the longest
+	// key; u32str holds the path from the root and is reused for every suffix
 	void List(std::u32string &u32str, int node) const
 	{
-		if (tree[node].end == oo)
+		std::vector<std::pair<int, size_t>> stack{{node, u32str.size()}};
+		while (!stack.empty())
 		{
-			for (int i = tree[node].start; i < text.size(); ++i)
+			auto [curNode, depth] = stack.back();
+			stack.pop_back();
+			u32str.resize(depth);
+			int end = tree[curNode].IsLeaf() ? text.size() : tree[curNode].end;
+			u32str.append(text, std::max(tree[curNode].start, 0), std::max(end - tree[curNode].start, 0));
+			if (tree[curNode].IsLeaf())
 			{
-				u32str.push_back(text[i]);
+				std::cout << una::norm::to_nfc_utf8(una::utf32to8(u32str)) << '\n';
+				continue;
 			}
-			std::cout << una::norm::to_nfc_utf8(una::utf32to8(u32str)) << '\n';
-			return;
-		}
-		for (int i = tree[node].start; i < tree[node].end; ++i)
-		{
-			u32str.push_back(text[i]);
-		}
-		for (auto next = tree[node].next.Begin(); next != tree[node].next.End(); ++next)
-		{
-			auto orig = u32str.size();
-			List(u32str, *next.second);
-			u32str.resize(orig);
+			size_t mark = stack.size();
+			ForEachChild(curNode, [&](char32_t, int child) { stack.emplace_back(child, u32str.size()); });
+			std::reverse(stack.begin() + mark, stack.end());
 		}
 	}
 
   public:
-	SuffixTreeRB()
+	BasicSuffixTreeRB()
 	{
 		needSL = 0;
 		remainder = 0, activeNode = 0, activeEdge = 0, activeLength = 0;
@@ -243,6 +273,7 @@ class SuffixTreeRB
 			return;
 		}
 		std::u32string u32str = una::utf8to32u(una::norm::to_nfd_utf8(key));
+		indexed = false;
 		satellite.emplace_back(value, u32str.size(), text.size());
 		for (const char32_t &c : u32str)
 		{
@@ -269,62 +300,77 @@ class SuffixTreeRB
 			return false;
 		}
 
-		std::ofstream textFileOut(directory / (const char8_t *)(filename + ".text").c_str(),
-								  std::ios::out | std::ios::binary);
-		std::ofstream treeFileOut(directory / (const char8_t *)(filename + ".tree").c_str(),
-								  std::ios::out | std::ios::binary);
-		std::ofstream sateFileOut(directory / (const char8_t *)(filename + ".sate").c_str(),
-								  std::ios::out | std::ios::binary);
-		if (!textFileOut || !treeFileOut || !sateFileOut)
-		{
-			return false;
-		}
-
-		int textSize = text.size();
-		textFileOut.write((const char *)&textSize, sizeof(textSize));
-		textFileOut.write((const char *)text.c_str(), textSize * sizeof(char32_t));
+		serial::Writer textOut;
+		textOut.Put((int)text.size());
+		textOut.Put(text.data(), text.size());
 
+		// struct of arrays: key lengths, key positions, end offsets of the values, then all values back to back
 		int satCnt = satellite.size();
-		sateFileOut.write((const char *)&satCnt, sizeof(satCnt));
+		std::vector<int> keyLens, keyPoss;
+		std::vector<uint64_t> dataEnds;
+		keyLens.reserve(satCnt);
+		keyPoss.reserve(satCnt);
+		dataEnds.reserve(satCnt);
+		uint64_t dataEnd = 0;
 		for (const auto &sat : satellite)
 		{
-			int dataSize = sat.data.size();
-			sateFileOut.write((const char *)&dataSize, sizeof(dataSize));
-			sateFileOut.write((const char *)sat.data.c_str(), dataSize * sizeof(char));
-			sateFileOut.write((const char *)&sat.keyLen, sizeof(sat.keyLen));
-			sateFileOut.write((const char *)&sat.keyPos, sizeof(sat.keyPos));
+			keyLens.push_back(sat.keyLen);
+			keyPoss.push_back(sat.keyPos);
+			dataEnds.push_back(dataEnd += sat.data.size());
+		}
+		serial::Writer sateOut;
+		sateOut.Put(satCnt);
+		sateOut.Put(keyLens);
+		sateOut.Put(keyPoss);
+		sateOut.Put(dataEnds);
+		for (const auto &sat : satellite)
+		{
+			sateOut.Put(sat.data.data(), sat.data.size());
 		}
 
-		// This maybe is not needed
-		treeFileOut.write((const char *)&root, sizeof(root));
-		treeFileOut.write((const char *)&needSL, sizeof(needSL));
-		treeFileOut.write((const char *)&remainder, sizeof(remainder));
-		//
-
-		treeFileOut.write((const char *)&activeNode, sizeof(activeNode));
-		treeFileOut.write((const char *)&activeEdge, sizeof(activeEdge));
-		treeFileOut.write((const char *)&activeLength, sizeof(activeLength));
-
+		// struct of arrays: starts, ends, links, child counts, then the children of all nodes in order
 		int treeSize = tree.size();
-		treeFileOut.write((const char *)&treeSize, sizeof(treeSize));
-		for (const auto &node : tree)
-		{
-			treeFileOut.write((const char *)&node.start, sizeof(node.start));
-			treeFileOut.write((const char *)&node.end, sizeof(node.end));
-			treeFileOut.write((const char *)&node.link, sizeof(node.link));
-			int mapSize = node.next.Size();
-			treeFileOut.write((const char *)&mapSize, sizeof(mapSize));
-			for (auto next = node.next.Begin(); next != node.next.End(); ++next)
-			{
-				treeFileOut.write((const char *)next.first, sizeof(*next.first));
-				treeFileOut.write((const char *)next.second, sizeof(*next.second));
-			}
+		std::vector<int> starts, ends, links, childCounts, childNodes;
+		std::vector<char32_t> childChars;
+		starts.reserve(treeSize);
+		ends.reserve(treeSize);
+		links.reserve(treeSize);
+		childCounts.reserve(treeSize);
+		childNodes.reserve(treeSize);
+		childChars.reserve(treeSize);
+		for (int i = 0; i < treeSize; ++i)
+		{
+			starts.push_back(tree[i].start);
+			ends.push_back(tree[i].end);
+			links.push_back(tree[i].link);
+			childCounts.push_back(edges.Size(tree[i].next, i));
+			ForEachChild(i, [&](char32_t c, int child) {
+				childChars.push_back(c);
+				childNodes.push_back(child);
+			});
 		}
-
-		return true;
+		serial::Writer treeOut;
+		treeOut.Put(root);
+		treeOut.Put(needSL);
+		treeOut.Put(remainder);
+		treeOut.Put(activeNode);
+		treeOut.Put(activeEdge);
+		treeOut.Put(activeLength);
+		treeOut.Put(treeSize);
+		treeOut.Put(starts);
+		treeOut.Put(ends);
+		treeOut.Put(links);
+		treeOut.Put(childCounts);
+		treeOut.Put((int)childNodes.size());
+		treeOut.Put(childChars);
+		treeOut.Put(childNodes);
+
+		return textOut.Save(directory / (const char8_t *)(filename + ".text").c_str(), serial::TEXT) &&
+			   treeOut.Save(directory / (const char8_t *)(filename + ".tree").c_str(), serial::TREE) &&
+			   sateOut.Save(directory / (const char8_t *)(filename + ".sate").c_str(), serial::SATE);
 	}
 
-	// Load the data from files
+	// Load the data from files, the tree is left untouched if they are missing or corrupted
 	bool Deserialize(std::filesystem::path directory, std::string filename)
 	{
 		if (!std::filesystem::is_directory(directory))
@@ -332,68 +378,174 @@ class SuffixTreeRB
 			return false;
 		}
 
-		std::ifstream textFileIn(directory / (const char8_t *)(filename + ".text").c_str(),
-								 std::ios::in | std::ios::binary);
-		std::ifstream treeFileIn(directory / (const char8_t *)(filename + ".tree").c_str(),
-								 std::ios::in | std::ios::binary);
-		std::ifstream sateFileIn(directory / (const char8_t *)(filename + ".sate").c_str(),
-								 std::ios::in | std::ios::binary);
-		if (!textFileIn || !treeFileIn || !sateFileIn)
+		serial::Reader textIn, treeIn, sateIn;
+		if (!textIn.Load(directory / (const char8_t *)(filename + ".text").c_str(), serial::TEXT) ||
+			!treeIn.Load(directory / (const char8_t *)(filename + ".tree").c_str(), serial::TREE) ||
+			!sateIn.Load(directory / (const char8_t *)(filename + ".sate").c_str(), serial::SATE))
 		{
 			return false;
 		}
 
 		int textSize;
-		textFileIn.read((char *)&textSize, sizeof(textSize));
-		text.resize(textSize);
-		textFileIn.read((char *)text.data(), textSize * sizeof(char32_t));
+		std::vector<char32_t> u32text;
+		if (!textIn.Get(textSize) || textSize < 0 || !textIn.Get(u32text, textSize) || !textIn.Done())
+		{
+			return false;
+		}
 
 		int satCnt;
-		sateFileIn.read((char *)&satCnt, sizeof(satCnt));
-		satellite.resize(satCnt);
-		for (auto &sat : satellite)
+		std::vector<int> keyLens, keyPoss;
+		std::vector<uint64_t> dataEnds;
+		if (!sateIn.Get(satCnt) || satCnt < 0 || !sateIn.Get(keyLens, satCnt) || !sateIn.Get(keyPoss, satCnt) ||
+			!sateIn.Get(dataEnds, satCnt))
 		{
-			int dataSize;
-			sateFileIn.read((char *)&dataSize, sizeof(dataSize));
-			sat.data.resize(dataSize);
-			sateFileIn.read((char *)sat.data.data(), dataSize * sizeof(char));
-			sateFileIn.read((char *)&sat.keyLen, sizeof(sat.keyLen));
-			sateFileIn.read((char *)&sat.keyPos, sizeof(sat.keyPos));
+			return false;
+		}
+		std::vector<Satellite> sats(satCnt);
+		uint64_t dataBegin = 0;
+		for (int i = 0; i < satCnt; ++i)
+		{
+			if (keyLens[i] < 0 || keyPoss[i] < 0 || keyPoss[i] > textSize - keyLens[i] || dataEnds[i] < dataBegin)
+			{
+				return false;
+			}
+			sats[i].keyLen = keyLens[i];
+			sats[i].keyPos = keyPoss[i];
+			sats[i].data.resize(dataEnds[i] - dataBegin);
+			if (!sateIn.Get(sats[i].data.data(), sats[i].data.size()))
+			{
+				return false;
+			}
+			dataBegin = dataEnds[i];
+		}
+		if (!sateIn.Done())
+		{
+			return false;
 		}
 
-		// This maybe is not needed
-		treeFileIn.read((char *)&root, sizeof(root));
-		treeFileIn.read((char *)&needSL, sizeof(needSL));
-		treeFileIn.read((char *)&remainder, sizeof(remainder));
-		//
-
-		treeFileIn.read((char *)&activeNode, sizeof(activeNode));
-		treeFileIn.read((char *)&activeEdge, sizeof(activeEdge));
-		treeFileIn.read((char *)&activeLength, sizeof(activeLength));
+		int state[6], treeSize, edgeCount;
+		std::vector<int> starts, ends, links, childCounts, childNodes;
+		std::vector<char32_t> childChars;
+		if (!treeIn.Get(state, 6) || !treeIn.Get(treeSize) || treeSize <= 0 || !treeIn.Get(starts, treeSize) ||
+			!treeIn.Get(ends, treeSize) || !treeIn.Get(links, treeSize) || !treeIn.Get(childCounts, treeSize) ||
+			!treeIn.Get(edgeCount) || edgeCount < 0 || !treeIn.Get(childChars, edgeCount) ||
+			!treeIn.Get(childNodes, edgeCount) || !treeIn.Done())
+		{
+			return false;
+		}
+		if (!serial::CheckTree(textSize, satCnt, state, starts, ends, links))
+		{
+			return false;
+		}
 
-		int treeSize = tree.size();
-		treeFileIn.read((char *)&treeSize, sizeof(treeSize));
-		tree.resize(treeSize);
-		for (auto &node : tree)
-		{
-			treeFileIn.read((char *)&node.start, sizeof(node.start));
-			treeFileIn.read((char *)&node.end, sizeof(node.end));
-			treeFileIn.read((char *)&node.link, sizeof(node.link));
-			int mapSize = node.next.Size();
-			treeFileIn.read((char *)&mapSize, sizeof(mapSize));
-			for (int i = 0; i < mapSize; ++i)
+		std::vector<Node> nodes(treeSize);
+		Edges loaded;
+		int edge = 0;
+		for (int i = 0; i < treeSize; ++i)
+		{
+			if (childCounts[i] < 0 || childCounts[i] > edgeCount - edge)
+			{
+				return false;
+			}
+			nodes[i].start = starts[i];
+			nodes[i].end = ends[i];
+			nodes[i].link = links[i];
+			for (int j = 0; j < childCounts[i]; ++j, ++edge)
 			{
-				char32_t c;
-				int child;
-				treeFileIn.read((char *)&c, sizeof(c));
-				treeFileIn.read((char *)&child, sizeof(child));
-				node.next[c] = child;
+				if (childNodes[edge] <= 0 || childNodes[edge] >= treeSize)
+				{
+					return false;
+				}
+				loaded.Set(nodes[i].next, i, childChars[edge], childNodes[edge]);
 			}
 		}
+		if (edge != edgeCount)
+		{
+			return false;
+		}
 
+		indexed = false;
+		text.assign(u32text.begin(), u32text.end());
+		satellite = std::move(sats);
+		tree = std::move(nodes);
+		edges = std::move(loaded);
+		root = state[0];
+		needSL = state[1];
+		remainder = state[2];
+		activeNode = state[3];
+		activeEdge = state[4];
+		activeLength = state[5];
+		BuildIndex();
 		return true;
 	}
 
+	// Save the data into a single flat file that MappedSuffixTree can query in place.
+	// The building state is not kept, so the file cannot be extended after loading.
+	bool SerializeFlat(std::filesystem::path directory, std::string filename) const
+	{
+		if (!std::filesystem::exists(directory))
+		{
+			std::filesystem::create_directories(directory);
+		}
+		else if (!std::filesystem::is_directory(directory))
+		{
+			return false;
+		}
+
+		std::vector<flat::Node> nodes;
+		std::vector<uint32_t> edgeOffsets;
+		std::vector<flat::Edge> flatEdges;
+		nodes.reserve(tree.size());
+		edgeOffsets.reserve(tree.size() + 1);
+		for (int i = 0; i < tree.size(); ++i)
+		{
+			nodes.push_back({tree[i].start, tree[i].end, tree[i].link});
+			edgeOffsets.push_back(flatEdges.size());
+			ForEachChild(i, [&](char32_t c, int child) { flatEdges.push_back({c, child}); });
+		}
+		edgeOffsets.push_back(flatEdges.size());
+
+		std::vector<flat::Satellite> sats;
+		std::vector<uint32_t> dataOffsets{0};
+		sats.reserve(satellite.size());
+		dataOffsets.reserve(satellite.size() + 1);
+		uint64_t dataBytes = 0;
+		for (const auto &sat : satellite)
+		{
+			sats.push_back({sat.keyLen, sat.keyPos});
+			dataBytes += sat.data.size();
+			dataOffsets.push_back(dataBytes);
+		}
+		// every offset in the file is 32-bit
+		if (dataBytes > std::numeric_limits<uint32_t>::max() || flatEdges.size() > std::numeric_limits<uint32_t>::max())
+		{
+			return false;
+		}
+
+		flat::Header header{flat::MAGIC,		  flat::VERSION,		  flat::ENDIAN,
+							(uint32_t)text.size(), (uint32_t)nodes.size(), (uint32_t)flatEdges.size(),
+							(uint32_t)sats.size(), (uint32_t)dataBytes};
+
+		std::ofstream fileOut(directory / (const char8_t *)(filename + ".flat").c_str(),
+							  std::ios::out | std::ios::binary);
+		if (!fileOut)
+		{
+			return false;
+		}
+		fileOut.write((const char *)&header, sizeof(header));
+		fileOut.write((const char *)text.data(), text.size() * sizeof(char32_t));
+		fileOut.write((const char *)nodes.data(), nodes.size() * sizeof(flat::Node));
+		fileOut.write((const char *)edgeOffsets.data(), edgeOffsets.size() * sizeof(uint32_t));
+		fileOut.write((const char *)flatEdges.data(), flatEdges.size() * sizeof(flat::Edge));
+		fileOut.write((const char *)sats.data(), sats.size() * sizeof(flat::Satellite));
+		fileOut.write((const char *)dataOffsets.data(), dataOffsets.size() * sizeof(uint32_t));
+		for (const auto &sat : satellite)
+		{
+			fileOut.write(sat.data.data(), sat.data.size());
+		}
+		return (bool)fileOut;
+	}
+
 	size_t Count() const
 	{
 		return text.size();
@@ -411,12 +563,12 @@ class SuffixTreeRB
 		{
 			if (curLength == tree[curNode].EdgeLength(text.size() - 1))
 			{
-				auto child = tree[curNode].next.Find(u32strv[i]);
-				if (child == tree[curNode].next.End())
+				int child = Child(curNode, u32strv[i]);
+				if (child == 0)
 				{
 					return false;
 				}
-				curNode = *child.second;
+				curNode = child;
 				curLength = 1;
 			}
 			else if (u32strv[i] == text[tree[curNode].start + curLength])
@@ -431,11 +583,69 @@ class SuffixTreeRB
 		return true;
 	}
 
-	std::vector<KeyValue> Find(std::string key)
+	// Index the satellites below every node, so that Find reports each matching entry once in time proportional to
+	// the number of entries instead of the number of leaves below the match.
+	// Muthukrishnan: the entries in docs[lower, upper) are reported exactly once by the positions whose previous
+	// occurrence lies before lower, found one after another with range minimum queries over prevDoc.
+	// Deserialize builds it, adding a key drops it until the next call.
+	void BuildIndex()
+	{
+		leafBegin.assign(tree.size(), 0);
+		leafEnd.assign(tree.size(), 0);
+		docs.clear();
+		std::vector<std::pair<int, bool>> stack{{root, false}};
+		std::vector<int> children;
+		while (!stack.empty())
+		{
+			auto [node, done] = stack.back();
+			stack.pop_back();
+			if (done)
+			{
+				leafEnd[node] = docs.size();
+				continue;
+			}
+			leafBegin[node] = docs.size();
+			if (tree[node].IsLeaf())
+			{
+				docs.push_back(-tree[node].link);
+				leafEnd[node] = docs.size();
+				continue;
+			}
+			stack.emplace_back(node, true);
+			children.clear();
+			ForEachChild(node, [&](char32_t, int child) { children.push_back(child); });
+			for (auto child = children.rbegin(); child != children.rend(); ++child)
+			{
+				stack.emplace_back(*child, false);
+			}
+		}
+		std::vector<int> last(satellite.size(), -1), prev(docs.size());
+		for (int i = 0; i < docs.size(); ++i)
+		{
+			prev[i] = last[docs[i]];
+			last[docs[i]] = i;
+		}
+		prevDoc = RangeMin(std::move(prev));
+		indexed = true;
+	}
+
+	// Return every entry whose key contains the given key, in the order of the leaves.
+	// Find does not modify the tree, so it may run concurrently with other const calls. It uses the document index when
+	// there is one, after a batch of Add call BuildIndex again, otherwise Find walks every leaf below the match.
+	std::vector<KeyValue> Find(std::string key) const
 	{
+		std::vector<KeyValue> keyValue;
+		Find(key, keyValue);
+		return keyValue;
+	}
+
+	// Same as above, into a caller-supplied buffer which is cleared first, so repeated queries can reuse its storage
+	void Find(std::string key, std::vector<KeyValue> &keyValue) const
+	{
+		keyValue.clear();
 		if (key.empty() || !una::is_valid_utf8(key))
 		{
-			return {};
+			return;
 		}
 		std::u32string u32key = una::utf8to32u(una::norm::to_nfd_utf8(key));
 		int curNode = 0, curLength = 0;
@@ -443,12 +653,12 @@ class SuffixTreeRB
 		{
 			if (curLength == tree[curNode].EdgeLength(text.size() - 1))
 			{
-				auto child = tree[curNode].next.Find(u32key[i]);
-				if (child == tree[curNode].next.End())
+				int child = Child(curNode, u32key[i]);
+				if (child == 0)
 				{
-					return {};
+					return;
 				}
-				curNode = *child.second;
+				curNode = child;
 				curLength = 1;
 			}
 			else if (u32key[i] == text[tree[curNode].start + curLength])
@@ -457,35 +667,63 @@ class SuffixTreeRB
 			}
 			else
 			{
-				return {};
+				return;
 			}
 		}
-		std::vector<KeyValue> keyValue;
-		std::vector<int> collected;
-		Collect(curNode, keyValue, collected);
-		for (const auto &i : collected)
+		if (!indexed)
+		{
+			Collect(curNode, keyValue);
+			return;
+		}
+
+		// positions still to report are found left to right, an upper bound of -1 marks a single position
+		int lower = leafBegin[curNode];
+		std::vector<std::pair<int, int>> ranges{{lower, leafEnd[curNode]}};
+		while (!ranges.empty())
 		{
-			satellite[i].keyPos = -(satellite[i].keyPos + 1);
+			auto [first, last] = ranges.back();
+			ranges.pop_back();
+			if (last == -1)
+			{
+				keyValue.emplace_back(satellite[docs[first]], text);
+				continue;
+			}
+			if (first >= last)
+			{
+				continue;
+			}
+			int i = prevDoc.ArgMin(first, last);
+			if (prevDoc.Value(i) >= lower)
+			{
+				continue;
+			}
+			ranges.emplace_back(i + 1, last);
+			ranges.emplace_back(i, -1);
+			ranges.emplace_back(first, i);
 		}
-		return keyValue;
 	}
 
-	void Collect(int curNode, std::vector<KeyValue> &keyValue, std::vector<int> &collected)
+	// append the entries of the leaves below curNode, each once, depth first with an explicit stack
+	void Collect(int curNode, std::vector<KeyValue> &keyValue) const
 	{
-		if (tree[curNode].IsLeaf())
+		std::unordered_set<int> collected; // only the reported entries, a query pays for its hits and not the tree
+		std::vector<int> stack{curNode};
+		while (!stack.empty())
 		{
-			int i = -tree[curNode].link;
-			if (satellite[i].keyPos >= 0)
+			int node = stack.back();
+			stack.pop_back();
+			if (tree[node].IsLeaf())
 			{
-				keyValue.emplace_back(satellite[i], text);
-				satellite[i].keyPos = -satellite[i].keyPos - 1; // minus 1 to ensure marked value is negative
-				collected.push_back(i);
+				int i = -tree[node].link;
+				if (collected.insert(i).second)
+				{
+					keyValue.emplace_back(satellite[i], text);
+				}
+				continue;
 			}
-			return;
-		}
-		for (auto child = tree[curNode].next.Begin(); child != tree[curNode].next.End(); ++child)
-		{
-			Collect(*child.second, keyValue, collected);
+			size_t mark = stack.size();
+			ForEachChild(node, [&](char32_t, int child) { stack.push_back(child); });
+			std::reverse(stack.begin() + mark, stack.end());
 		}
 	}
 
@@ -503,3 +741,5 @@ class SuffixTreeRB
 		return true;
 	}
 };
+
+using SuffixTreeRB = BasicSuffixTreeRB<>;